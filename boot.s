@@ -2,22 +2,44 @@ BITS 32
 
 global _start
 global idt_load
-global isr0
+global gdt_flush
+global isr_stub_table
+global syscall_int80
+global sysenter_entry
+global user_enter
+global user_return
+global ap_trampoline
+global ap_boot_data
+global ap_trampoline_end
+global ipi_wake
+global lapic_spurious
 
 extern kernel_main
-extern isr0_c
+extern isr_c
+extern syscall_dispatch
+extern smp_ipi_eoi
+
+MB_MAGIC    equ 0x1BADB002
+MB_FLAGS    equ 0x3                 ; page-align modules, provide memory info
+
+KERNEL_CODE equ 0x08                ; selectors, see src/gdt.h
+KERNEL_DATA equ 0x10
+USER_CODE   equ 0x1B
+USER_DATA   equ 0x23
 
 section .multiboot
 align 4
-    dd 0x1BADB002
-    dd 0x0
-    dd -(0x1BADB002)
+    dd MB_MAGIC
+    dd MB_FLAGS
+    dd -(MB_MAGIC + MB_FLAGS)
 
 section .text
 
 _start:
     cli
     mov esp, stack_top
+    push ebx                        ; multiboot info
+    push eax                        ; bootloader magic
     call kernel_main
 
 .hang:
@@ -29,40 +51,268 @@ idt_load:
     lidt [eax]
     ret
 
-isr0:
-    cli
+; void gdt_flush(uint32_t gdtp, uint32_t code, uint32_t data, uint32_t tss)
+gdt_flush:
+    mov eax, [esp + 4]
+    lgdt [eax]
+    mov eax, [esp + 12]
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov eax, [esp + 16]
+    ltr ax
+    push dword [esp + 8]            ; far return into the new code segment
+    push .reload
+    retf
+.reload:
+    ret
 
-    pushad
+; CPU exceptions. Each stub pushes a dummy error code where the CPU does not,
+; then the vector, so isr_c always sees the same frame (struct trap_frame).
+%macro ISR_NOERR 1
+isr%1:
+    push dword 0
+    push dword %1
+    jmp isr_common
+%endmacro
+
+%macro ISR_ERR 1
+isr%1:
+    push dword %1
+    jmp isr_common
+%endmacro
 
-    push ds
-    push es
-    push fs
-    push gs
-    
+ISR_NOERR 0
+ISR_NOERR 1
+ISR_NOERR 2
+ISR_NOERR 3
+ISR_NOERR 4
+ISR_NOERR 5
+ISR_NOERR 6
+ISR_NOERR 7
+ISR_ERR   8
+ISR_NOERR 9
+ISR_ERR   10
+ISR_ERR   11
+ISR_ERR   12
+ISR_ERR   13
+ISR_ERR   14
+ISR_NOERR 15
+ISR_NOERR 16
+ISR_ERR   17
+ISR_NOERR 18
+ISR_NOERR 19
+ISR_NOERR 20
+ISR_NOERR 21
+ISR_NOERR 22
+ISR_NOERR 23
+ISR_NOERR 24
+ISR_NOERR 25
+ISR_NOERR 26
+ISR_NOERR 27
+ISR_NOERR 28
+ISR_NOERR 29
+ISR_NOERR 30
+ISR_NOERR 31
 
-    mov ax, 0x10
+isr_common:
+    pushad
+    cld
+    mov ax, KERNEL_DATA
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
-    
+    test byte [esp + 44], 3         ; cs of the interrupted code
+    jz .kernel
+    mov gs, [user_kernel_gs]
+.kernel:
+    push esp                        ; struct trap_frame*
+    call isr_c
+    add esp, 4
+    popad
+    add esp, 8                      ; vector and error code
+    iret
 
-    ;call isr0_c
-    
+section .rodata
+isr_stub_table:
+    dd isr0, isr1, isr2, isr3
+    dd isr4, isr5, isr6, isr7
+    dd isr8, isr9, isr10, isr11
+    dd isr12, isr13, isr14, isr15
+    dd isr16, isr17, isr18, isr19
+    dd isr20, isr21, isr22, isr23
+    dd isr24, isr25, isr26, isr27
+    dd isr28, isr29, isr30, isr31
+
+section .text
 
+; System call entries: eax = number, ebx/esi/edi = arguments, result in eax.
+; The C dispatcher preserves ebx/esi/edi/ebp; ecx and edx are clobbered.
+syscall_int80:
+    cld                             ; the C code assumes DF = 0, whatever the user left
+    push dword KERNEL_DATA
+    pop ds
+    push dword KERNEL_DATA
+    pop es
+    mov gs, [user_kernel_gs]
+    push edi
+    push esi
+    push ebx
+    push eax
+    call syscall_dispatch
+    add esp, 16
+    push dword USER_DATA
+    pop ds
+    push dword USER_DATA
+    pop es
+    push dword USER_DATA
     pop gs
-    pop fs
+    iret
+
+; SYSENTER arrives on the stack from MSR 0x175 with the user's stack pointer
+; in ecx and return address in edx, which SYSEXIT takes back from the same
+; registers. SYSENTER leaves EFLAGS.TF alone: a user single-stepping into it
+; gets a #DB here in ring 0, which isr_c dismisses.
+sysenter_entry:
+    cld
+    push ecx
+    push edx
+    push dword KERNEL_DATA
+    pop ds
+    push dword KERNEL_DATA
     pop es
+    mov gs, [user_kernel_gs]
+    push edi
+    push esi
+    push ebx
+    push eax
+    call syscall_dispatch
+    add esp, 16
+    push dword USER_DATA
     pop ds
-    
+    push dword USER_DATA
+    pop es
+    push dword USER_DATA
+    pop gs
+    pop edx
+    pop ecx
+    sysexit
+
+; int user_enter(uint32_t entry, uint32_t esp)
+; Drops to ring 3 at `entry`. Returns when user_return is called, with its code.
+; %gs holds the per-CPU segment in the kernel; it is saved here and put back
+; on every entry from ring 3.
+user_enter:
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [user_kernel_esp], esp
+    mov [user_kernel_gs], gs
+    mov edx, [esp + 20]
+    mov ecx, [esp + 24]
+    mov ax, USER_DATA
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    push dword USER_DATA            ; ss
+    push ecx                        ; esp
+    push dword 0x002                ; eflags: interrupts stay off
+    push dword USER_CODE            ; cs
+    push edx                        ; eip
+    xor eax, eax
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor ebp, ebp
+    iret
+
+; void user_return(int code): abandon the ring 3 program and return from user_enter
+user_return:
+    mov eax, [esp + 4]
+    mov esp, [user_kernel_esp]
+    mov cx, KERNEL_DATA
+    mov ds, cx
+    mov es, cx
+    mov fs, cx
+    mov gs, [user_kernel_gs]
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
 
+; Wake-up IPI for a CPU halted in pool_worker: acknowledge it and let the
+; hlt finish. Spurious local APIC interrupts must not be acknowledged.
+ipi_wake:
+    pushad
+    call smp_ipi_eoi
     popad
-    
     iret
 
+lapic_spurious:
+    iret
+
+; Application processor start-up (src/smp.c). smp_init copies everything
+; from ap_trampoline to ap_trampoline_end to AP_TRAMPOLINE and fills in
+; ap_boot_data (struct ap_boot); a start-up IPI then starts each AP here in
+; real mode with cs:ip = 0800:0000. Addresses are computed for the copy.
+AP_TRAMPOLINE equ 0x8000
+%define AP_ADDR(x) (AP_TRAMPOLINE + (x) - ap_trampoline)
+
+section .rodata
+align 16
+BITS 16
+ap_trampoline:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    o32 lgdt [AP_ADDR(ap_boot_data)]
+    mov eax, cr0
+    or eax, 1                       ; protected mode, paging comes later
+    mov cr0, eax
+    jmp dword KERNEL_CODE:AP_ADDR(ap_protected)
+
+BITS 32
+ap_protected:
+    mov ax, KERNEL_DATA
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov ss, ax
+    lidt [AP_ADDR(ap_boot_data) + 8]
+    mov eax, [AP_ADDR(ap_boot_data) + 20]
+    mov cr4, eax                    ; PSE before the 4 MiB pages are used
+    mov eax, [AP_ADDR(ap_boot_data) + 16]
+    mov cr3, eax
+    mov eax, [AP_ADDR(ap_boot_data) + 24]
+    mov cr0, eax                    ; paging and write protect, as on the boot CPU
+    mov esp, [AP_ADDR(ap_boot_data) + 28]
+    mov gs, [AP_ADDR(ap_boot_data) + 32]
+    call [AP_ADDR(ap_boot_data) + 36]
+.hang:
+    hlt
+    jmp .hang
+
+align 4
+ap_boot_data:
+    times 40 db 0
+ap_trampoline_end:
+
 section .bss
 align 16
 
+user_kernel_esp:
+    resd 1
+user_kernel_gs:
+    resd 1
+
+align 16
 stack_bottom:
     resb 16384
-stack_top:
\ No newline at end of file
+stack_top:
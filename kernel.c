@@ -1,10 +1,31 @@
 #include <stdint.h>
 #include "io.h"
 #include "fs.h"
+#include "serial.h"
+#include "timer.h"
+#include "trace.h"
+#include "math64.h"
+#include "gapbuf.h"
+#include "crc32c.h"
+#include "ata.h"
+#include "blkdev.h"
+#include "stripe.h"
+#include "ahci.h"
+#include "ramdisk.h"
+#include "multiboot.h"
+#include "gdt.h"
+#include "paging.h"
+#include "user.h"
+#include "syscall.h"
+#include "lz.h"
+#include "percpu.h"
+#include "smp.h"
+#include "pool.h"
 
 static volatile uint16_t* const VGA_BUFFER = (uint16_t*)0xB8000;
 static const int VGA_COLS = 80;
 static const int VGA_ROWS = 25;
+#define VGA_COLS_MAX 80     // compile-time width for line buffers
 
 // VGA text mode output
 static uint8_t vga_entry_color(uint8_t fg, uint8_t bg){
@@ -39,6 +60,50 @@ static int kstrcmp(const char* a, const char* b){
     return (unsigned char)a[i] - (unsigned char)b[i];
 }
 
+// Format an unsigned 64-bit value in decimal, returns the string length
+static int kutoa(uint64_t v, char* out){
+    char tmp[21];
+    int n = 0;
+    do {
+        uint32_t digit;
+        v = div_u64_u32(v, 10, &digit);
+        tmp[n++] = (char)('0' + digit);
+    } while (v != 0);
+
+    for (int i = 0; i < n; ++i){
+        out[i] = tmp[n - 1 - i];
+    }
+    out[n] = '\0';
+    return n;
+}
+
+static char* khex(char* p, uint32_t v){
+    for (int s = 28; s >= 0; s -= 4){
+        *p++ = "0123456789abcdef"[(v >> s) & 0xF];
+    }
+    *p = '\0';
+    return p;
+}
+
+// Cut `s` after its first word and return the rest, or 0 if there is none
+static char* split_arg(char* s){
+    if (!s) return 0;
+    while (*s && *s != ' ') s++;
+    if (*s == '\0') return 0;
+    *s++ = '\0';
+    while (*s == ' ') s++;
+    return (*s) ? s : 0;
+}
+
+// Copy src to dst, return a pointer to the new terminator for chaining
+static char* kstrcpy_end(char* dst, const char* src){
+    while (*src){
+        *dst++ = *src++;
+    }
+    *dst = '\0';
+    return dst;
+}
+
 static void shell_print_line(const char* msg, int* row, uint8_t color){
     // Ensure we are in a valid row; keep existing behavior of clearing when full
     if (*row >= VGA_ROWS){
@@ -117,6 +182,17 @@ void update_cursor(int row, int col) {
 #define KBD_DATA_PORT 0x60
 #define KBD_STATUS_PORT 0x64
 
+// Navigation keys are returned as control codes that nothing else uses
+#define KEY_HOME    '\x12'
+#define KEY_UP      '\x13'
+#define KEY_PGUP    '\x14'
+#define KEY_LEFT    '\x15'
+#define KEY_RIGHT   '\x16'
+#define KEY_END     '\x17'
+#define KEY_DOWN    '\x18'
+#define KEY_PGDN    '\x19'
+#define KEY_DEL     '\x1A'
+
 
 static const char scancode_set1[128] = {
     [0x01] = '\033',  // Escape
@@ -159,11 +235,21 @@ static const char scancode_set1[128] = {
     [0x1D] = '\x11',  // Left Control (non-newline control code used to avoid colliding with Enter)
     [0x38] = 40,      // Left Alt
 
+    // Cursor block (sent after an 0xE0 prefix) and keypad with num lock off
+    [0x47] = KEY_HOME, [0x48] = KEY_UP,   [0x49] = KEY_PGUP,
+    [0x4B] = KEY_LEFT, [0x4D] = KEY_RIGHT,
+    [0x4F] = KEY_END,  [0x50] = KEY_DOWN, [0x51] = KEY_PGDN,
+    [0x53] = KEY_DEL,
+
 };
 
 static uint8_t keyboard_read_scancode(){
     while (!(inb(KBD_STATUS_PORT) & 0x01));
-    return inb(KBD_DATA_PORT);
+    uint8_t sc = inb(KBD_DATA_PORT);
+
+    ctr_inc(CTR_KBD_SCANCODE);
+    trace_event(EV_KBD_SCANCODE, sc, 0, 0);
+    return sc;
 }
 
 static char get_keyboard_char(void){
@@ -183,162 +269,955 @@ static char get_keyboard_char(void){
 
 void main_menu(void);
 
-void save_function(uint16_t* buffer){
-    uint8_t color = vga_entry_color(1, 15);
+// Editor state: the text lives in a gap buffer sized to the largest file the
+// filesystem can hold. The screen shows EDIT_ROWS display rows starting at
+// `top`; long lines wrap at EDIT_WIDTH. Each frame is rendered off-screen and
+// only rows that differ from `shadow` are written to VGA memory.
+#define EDIT_TOP    4
+#define EDIT_ROWS   20
+#define EDIT_LEFT   2
+#define EDIT_WIDTH  78
+#define STATUS_ROW  24
+#define NO_ROW      0xFFFFFFFFu
+#define ED_NAME_MAX 48      // longest path the save prompt accepts, plus NUL
+
+struct editor {
+    struct gapbuf gb;
+    uint32_t top;
+    char name[ED_NAME_MAX];
+    int dirty;
+    char shadow[EDIT_ROWS][EDIT_WIDTH];
+};
+
+static uint8_t editor_storage[FS_MAX_FILE_SIZE];
+static struct editor ed;
 
-    uint16_t snapshot[VGA_COLS * VGA_ROWS];
-    for (int i = 0; i < VGA_COLS * VGA_ROWS; i++){
-        snapshot[i] = buffer[i];
+static uint32_t ed_line_start(uint32_t pos){
+    while (pos > 0 && gb_at(&ed.gb, pos - 1) != '\n'){
+        pos--;
     }
+    return pos;
+}
 
-    kprint_at("Please enter file name (max 23 chars):", 20, 2, color);
-    char filename[24];
-    for (int i = 0; i < 24; ++i) filename[i] = '\0';
-    int row = 21, col = 2;
-    int fpos = 0;
+// Start of the display row that shows `pos`
+static uint32_t ed_row_start(uint32_t pos){
+    uint32_t ls = ed_line_start(pos);
+    return ls + ((pos - ls) / EDIT_WIDTH) * EDIT_WIDTH;
+}
 
-    enable_cursor(0, 15);
-    update_cursor(row, col);
+static uint32_t ed_prev_row_start(uint32_t rs){
+    if (rs == 0){
+        return 0;
+    }
+    if (gb_at(&ed.gb, rs - 1) != '\n'){
+        return rs - EDIT_WIDTH;    // rs is a wrapped continuation row
+    }
+    return ed_row_start(rs - 1);
+}
 
-    for (;;){
-        char ch = get_keyboard_char();
+// Start of the display row after the one starting at `rs`, or NO_ROW if that is the last
+static uint32_t ed_next_row_start(uint32_t rs){
+    uint32_t len = gb_length(&ed.gb);
+    for (uint32_t i = 0; i < EDIT_WIDTH; ++i){
+        if (rs + i >= len){
+            return NO_ROW;
+        }
+        if (gb_at(&ed.gb, rs + i) == '\n'){
+            return rs + i + 1;
+        }
+    }
+    return rs + EDIT_WIDTH;
+}
 
-        if (ch == '\b'){
-            if (fpos > 0){
-                fpos--;
-                if (col > 2) {
-                    col--;
-                } else if (row > 3) {
-                    row--;
-                    col = VGA_COLS - 1;
-                }
-                int idx = row * VGA_COLS + col;
-                VGA_BUFFER[idx] = vga_entry(' ', color);
-                update_cursor(row, col);
-            }
+// Furthest column the cursor may take on the row starting at `rs`
+static uint32_t ed_row_max_col(uint32_t rs){
+    uint32_t next = ed_next_row_start(rs);
+    if (next == NO_ROW){
+        return gb_length(&ed.gb) - rs;
+    }
+    if (gb_at(&ed.gb, next - 1) == '\n'){
+        return next - 1 - rs;
+    }
+    return EDIT_WIDTH - 1;
+}
+
+static void ed_move_rows(int delta){
+    uint32_t cur = gb_cursor(&ed.gb);
+    uint32_t rs = ed_row_start(cur);
+    uint32_t col = cur - rs;
+
+    for (; delta < 0; ++delta){
+        if (rs == 0) break;
+        rs = ed_prev_row_start(rs);
+    }
+    for (; delta > 0; --delta){
+        uint32_t next = ed_next_row_start(rs);
+        if (next == NO_ROW) break;
+        rs = next;
+    }
+
+    uint32_t max = ed_row_max_col(rs);
+    gb_move_to(&ed.gb, rs + (col < max ? col : max));
+}
+
+// Scroll so the cursor row is inside the viewport
+static void ed_scroll_to_cursor(void){
+    uint32_t cr = ed_row_start(gb_cursor(&ed.gb));
+
+    if (cr < ed.top){
+        ed.top = cr;
+        return;
+    }
+
+    uint32_t p = ed.top;
+    int rows = 0;
+    while (p < cr && rows < EDIT_ROWS){
+        p = ed_next_row_start(p);
+        rows++;
+    }
+    if (rows >= EDIT_ROWS){
+        ed.top = cr;
+        for (int i = 1; i < EDIT_ROWS; ++i){
+            ed.top = ed_prev_row_start(ed.top);
         }
-        else if (ch == '\033'){
-            disable_cursor();
-            clear_screen(color);
-            return;
+    }
+}
+
+static void ed_status(const char* msg){
+    uint8_t color = vga_entry_color(15, 1);
+    char line[VGA_COLS_MAX + 1];
+    int n = 0;
+
+    line[n++] = ' ';
+    for (int i = 0; ed.name[i] && n < 30; ++i){
+        line[n++] = ed.name[i];
+    }
+    if (!ed.name[0]){
+        n = kstrcpy_end(line + n, "[untitled]") - line;
+    }
+    if (ed.dirty){
+        n = kstrcpy_end(line + n, " *") - line;
+    }
+    n = kstrcpy_end(line + n, "  ") - line;
+    n += kutoa(gb_length(&ed.gb), line + n);
+    n = kstrcpy_end(line + n, " bytes  ") - line;
+    for (int i = 0; msg && msg[i] && n < VGA_COLS; ++i){
+        line[n++] = msg[i];
+    }
+    while (n < VGA_COLS){
+        line[n++] = ' ';
+    }
+    line[n] = '\0';
+    kprint_at(line, STATUS_ROW, 0, color);
+}
+
+static void ed_render(void){
+    uint8_t color = vga_entry_color(1, 15);
+    char frame[EDIT_ROWS][EDIT_WIDTH];
+    uint32_t len = gb_length(&ed.gb);
+    uint32_t cur = gb_cursor(&ed.gb);
+    int row = 0, col = 0;
+    int cur_row = 0, cur_col = 0;
+
+    for (int r = 0; r < EDIT_ROWS; ++r){
+        for (int c = 0; c < EDIT_WIDTH; ++c){
+            frame[r][c] = ' ';
         }
-        else if (ch == '\n'){
-            filename[fpos] = '\0';
-            /* Extract text area from the VGA buffer into a byte array */
-            uint8_t data[VGA_COLS * (VGA_ROWS - 4)];
-            int dpos = 0;
-            for (int r = 4; r < VGA_ROWS; ++r){
-                // Find the last non-space character in this row
-                int last_col = 1; // default to nothing
-                for (int c = 2; c < VGA_COLS; ++c){
-                    uint16_t entry = snapshot[r * VGA_COLS + c];
-                    char ch2 = (char)(entry & 0xFF);
-                    if (ch2 != ' ' && ch2 != '\0'){
-                        last_col = c;
-                    }
-                }
-                // Only write up to last non-space char, then a newline
-                for (int c = 2; c <= last_col; ++c){
-                    uint16_t entry = snapshot[r * VGA_COLS + c];
-                    char ch2 = (char)(entry & 0xFF);
-                    data[dpos++] = (uint8_t)ch2;
-                }
-                // Add a newline after each row (skip empty rows at end optionally)
-                if (last_col > 1){
-                    data[dpos++] = '\n';
-                }
-            }
+    }
 
-            while (dpos > 0 && data[dpos - 1] == '\n' && dpos < 19){
-                dpos--;
-            }
+    for (uint32_t p = ed.top; row < EDIT_ROWS; ++p){
+        if (col == EDIT_WIDTH){
+            row++;
+            col = 0;
+            if (row >= EDIT_ROWS) break;
+        }
+        if (p == cur){
+            cur_row = row;
+            cur_col = col;
+        }
+        if (p >= len) break;
 
-            int v = fs_write_file(filename, data, dpos);
-            if (v == 0){
-                kprint_at("File saved successfully!", row + 2, 2, color);
-            } else {
-                kprint_at("Error saving file!", row + 2, 2, color);
-            }
-            disable_cursor();
-            return;
+        char ch = (char)gb_at(&ed.gb, p);
+        if (ch == '\n'){
+            row++;
+            col = 0;
+        } else {
+            frame[row][col++] = ch;
         }
-        else {
-            if (fpos < 23 && ch >= ' '){
-                filename[fpos++] = ch;
-                int idx = row * VGA_COLS + col;
-                VGA_BUFFER[idx] = vga_entry(ch, color);
-                col++;
-                if (col >= VGA_COLS){
-                    col = 2;
-                    row++;
-                }
-                update_cursor(row, col);
+    }
+
+    for (int r = 0; r < EDIT_ROWS; ++r){
+        int changed = 0;
+        for (int c = 0; c < EDIT_WIDTH; ++c){
+            if (frame[r][c] != ed.shadow[r][c]){
+                changed = 1;
+                break;
             }
         }
+        if (!changed) continue;
+
+        int base = (EDIT_TOP + r) * VGA_COLS + EDIT_LEFT;
+        for (int c = 0; c < EDIT_WIDTH; ++c){
+            VGA_BUFFER[base + c] = vga_entry(frame[r][c], color);
+            ed.shadow[r][c] = frame[r][c];
+        }
+    }
+
+    update_cursor(EDIT_TOP + cur_row, EDIT_LEFT + cur_col);
+}
+
+// Ask for a file name on the status line, pre-filled with the current one.
+// Returns 0 on Enter with a non-empty name, -1 if cancelled.
+static int ed_prompt_name(void){
+    uint8_t color = vga_entry_color(15, 1);
+    char name[ED_NAME_MAX];
+    int len = 0;
+
+    for (int i = 0; i < ED_NAME_MAX; ++i) name[i] = '\0';
+    while (ed.name[len] && len < ED_NAME_MAX - 1){
+        name[len] = ed.name[len];
+        len++;
+    }
+
+    for (;;){
+        char line[VGA_COLS_MAX + 1];
+        char* p = kstrcpy_end(line, " Save as: ");
+        int col = p - line;
+        p = kstrcpy_end(p, name);
+        while (p < line + VGA_COLS) *p++ = ' ';
+        *p = '\0';
+        kprint_at(line, STATUS_ROW, 0, color);
+        update_cursor(STATUS_ROW, col + len);
+
+        char ch = get_keyboard_char();
+        if (ch == '\033'){
+            return -1;
+        } else if (ch == '\n'){
+            if (len == 0) continue;
+            for (int i = 0; i < ED_NAME_MAX; ++i) ed.name[i] = name[i];
+            return 0;
+        } else if (ch == '\b'){
+            if (len > 0) name[--len] = '\0';
+        } else if (ch > ' ' && ch <= '~' && len < ED_NAME_MAX - 1){
+            name[len++] = ch;
+        }
     }
-} 
+}
 
+static void ed_save(void){
+    if (ed_prompt_name() < 0){
+        ed_status("Save cancelled");
+        return;
+    }
+
+    // fs_write_file takes one run of bytes: close the gap, write, then put the cursor back
+    uint32_t cur = gb_cursor(&ed.gb);
+    int v = fs_write_file(ed.name, gb_contiguous(&ed.gb), gb_length(&ed.gb));
+    gb_move_to(&ed.gb, cur);
 
-void notepad(void){
+    if (v == 0){
+        ed.dirty = 0;
+        ed_status("File saved successfully!");
+    } else {
+        ed_status(fs_strerror(v));
+    }
+}
+
+void notepad(const char* open_name){
     uint8_t color = vga_entry_color(1, 15);
     clear_screen(color);
 
     kprint_at("TinyOS Notepad - Type your text below:", 1, 2, color);
-    kprint_at("press esc to exit", 2, 2, color);
+    kprint_at("esc: exit  ctrl+s: save  arrows/pgup/pgdn/home/end: move", 2, 2, color);
     kprint_at("----------------------------------------", 3, 2, color);
 
-    int row = 4, col = 2;
+    gb_init(&ed.gb, editor_storage, sizeof(editor_storage));
+    ed.top = 0;
+    ed.dirty = 0;
+    for (int i = 0; i < ED_NAME_MAX; ++i) ed.name[i] = '\0';
+    for (int r = 0; r < EDIT_ROWS; ++r){
+        for (int c = 0; c < EDIT_WIDTH; ++c){
+            ed.shadow[r][c] = ' ';   // matches the cleared screen
+        }
+    }
+
+    const char* msg = 0;
+    if (open_name){
+        for (int i = 0; i < ED_NAME_MAX - 1 && open_name[i]; ++i) ed.name[i] = open_name[i];
+        int n = fs_read_file(ed.name, editor_storage, sizeof(editor_storage));
+        if (n >= 0){
+            gb_adopt(&ed.gb, (uint32_t)n);
+        } else if (n == FS_ENOENT){
+            msg = "New file";
+        } else {
+            msg = fs_strerror(n);
+        }
+    }
 
     enable_cursor(0, 15);
-    update_cursor(row, col);
+    ed_status(msg);
+    ed_render();
 
     for (;;){
         char c = get_keyboard_char();
-        if (c == '\n'){
-            row++;
-            col = 2;
-            update_cursor(row, col);
+        msg = 0;
+
+        if (c == '\033'){
+            disable_cursor();
+            clear_screen(color);
+            return;
+        }
+        else if (c == '\x11'){
+            char x = get_keyboard_char();
+            if (x == 's'){
+                ed_save();
+                ed_render();
+                continue;
+            }
+        }
+        else if (c == KEY_LEFT){
+            uint32_t cur = gb_cursor(&ed.gb);
+            if (cur > 0) gb_move_to(&ed.gb, cur - 1);
+        }
+        else if (c == KEY_RIGHT){
+            gb_move_to(&ed.gb, gb_cursor(&ed.gb) + 1);
+        }
+        else if (c == KEY_UP){
+            ed_move_rows(-1);
+        }
+        else if (c == KEY_DOWN){
+            ed_move_rows(1);
+        }
+        else if (c == KEY_PGUP){
+            ed_move_rows(-(EDIT_ROWS - 1));
+        }
+        else if (c == KEY_PGDN){
+            ed_move_rows(EDIT_ROWS - 1);
+        }
+        else if (c == KEY_HOME){
+            gb_move_to(&ed.gb, ed_row_start(gb_cursor(&ed.gb)));
+        }
+        else if (c == KEY_END){
+            uint32_t rs = ed_row_start(gb_cursor(&ed.gb));
+            gb_move_to(&ed.gb, rs + ed_row_max_col(rs));
         }
         else if (c == '\b'){
-            if (col > 2){
-                col--;
+            if (gb_backspace(&ed.gb) >= 0) ed.dirty = 1;
+        }
+        else if (c == KEY_DEL){
+            if (gb_delete(&ed.gb) >= 0) ed.dirty = 1;
+        }
+        else if (c == '\t'){
+            // tabs become spaces up to the next 4-column stop
+            uint32_t cur = gb_cursor(&ed.gb);
+            uint32_t col = cur - ed_row_start(cur);
+            do {
+                if (gb_insert(&ed.gb, ' ') < 0){
+                    msg = "Buffer full";
+                    break;
+                }
+                ed.dirty = 1;
+            } while (++col % 4 != 0);
+        }
+        else if (c == '\n' || (c >= ' ' && c <= '~')){
+            if (gb_insert(&ed.gb, (uint8_t)c) < 0){
+                msg = "Buffer full";
+            } else {
+                ed.dirty = 1;
             }
-            else if ((row > 4) && (col == 2)){
-                row--;
-                col = VGA_COLS - 1;
+        }
+        else {
+            continue;
+        }
+
+        ed_scroll_to_cursor();
+        ed_status(msg);
+        ed_render();
+    }
+}
+
+// Pager for long shell output: text goes to rows 1..23 and when the screen is
+// full a prompt on the last row waits for a key before anything more is drawn.
+// Producers check `quit` after every call so they stop pulling data as soon as
+// the user leaves, which keeps memory use at one chunk regardless of input size.
+struct pager {
+    int row;
+    int col;
+    uint8_t color;
+    int quit;
+};
+
+static void pager_begin(struct pager* pg, int row, uint8_t color){
+    if (row >= VGA_ROWS - 1){
+        clear_screen(color);
+        row = 1;
+    }
+    pg->row = row;
+    pg->col = 2;
+    pg->color = color;
+    pg->quit = 0;
+}
+
+// Scroll text rows 2..last up by one, freeing the last text row
+static void pager_scroll_line(struct pager* pg){
+    int last = VGA_ROWS - 2;
+    for (int r = 1; r < last; ++r){
+        for (int c = 0; c < VGA_COLS; ++c){
+            VGA_BUFFER[r * VGA_COLS + c] = VGA_BUFFER[(r + 1) * VGA_COLS + c];
+        }
+    }
+    for (int c = 0; c < VGA_COLS; ++c){
+        VGA_BUFFER[last * VGA_COLS + c] = vga_entry(' ', pg->color);
+    }
+    pg->row = last;
+}
+
+static void pager_wait(struct pager* pg){
+    int prompt_row = VGA_ROWS - 1;
+    kprint_at("-- More -- (space: page, enter: line, q: quit)", prompt_row, 2,
+              vga_entry_color(0, 7));
+
+    for (;;){
+        char c = get_keyboard_char();
+        if (c == ' '){
+            clear_screen(pg->color);
+            pg->row = 1;
+            return;
+        }
+        if (c == '\n'){
+            for (int col = 0; col < VGA_COLS; ++col){
+                VGA_BUFFER[prompt_row * VGA_COLS + col] = vga_entry(' ', pg->color);
             }
-            int idx = row * VGA_COLS + col;
-            VGA_BUFFER[idx] = vga_entry(' ', color);
-            update_cursor(row, col);
+            pager_scroll_line(pg);
+            return;
         }
-        else if (c == '\033'){
-            disable_cursor();
-            clear_screen(color);
+        if (c == 'q' || c == '\033'){
+            for (int col = 0; col < VGA_COLS; ++col){
+                VGA_BUFFER[prompt_row * VGA_COLS + col] = vga_entry(' ', pg->color);
+            }
+            pg->row = prompt_row;
+            pg->quit = 1;
             return;
         }
+    }
+}
 
-        else if (c == '\x11'){
-            char x = get_keyboard_char();
-            if (x == 's'){
-                save_function(VGA_BUFFER);
+static void pager_newline(struct pager* pg){
+    pg->col = 2;
+    pg->row++;
+    if (pg->row >= VGA_ROWS - 1){
+        pager_wait(pg);
+    }
+}
+
+static void pager_putc(struct pager* pg, char ch){
+    if (pg->quit) return;
+
+    if (ch == '\n'){
+        pager_newline(pg);
+        return;
+    }
+    if (pg->col >= VGA_COLS){
+        pager_newline(pg);
+        if (pg->quit) return;
+    }
+    if (ch == '\t'){
+        ch = ' ';
+    } else if (ch < ' ' || ch > '~'){
+        ch = '.';
+    }
+    VGA_BUFFER[pg->row * VGA_COLS + pg->col] = vga_entry(ch, pg->color);
+    pg->col++;
+}
+
+static void pager_line(struct pager* pg, const char* s){
+    while (*s && !pg->quit){
+        pager_putc(pg, *s++);
+    }
+    pager_putc(pg, '\n');
+}
+
+// Finish the current line and return the row the shell should continue on
+static int pager_end(struct pager* pg){
+    if (!pg->quit && pg->col > 2){
+        pager_newline(pg);
+    }
+    return pg->row;
+}
+
+// Buffer for shell commands that work on a whole file at once
+static uint8_t scratch_buf[FS_MAX_FILE_SIZE];
+
+static void print_timing(const char* label, uint64_t cycles, uint32_t sectors, int* row, uint8_t color){
+    char out[64];
+    char* p = kstrcpy_end(out, label);
+    p += kutoa(timer_cycles_to_us(cycles), p);
+    p = kstrcpy_end(p, " us, ");
+    p += kutoa(sectors, p);
+    kstrcpy_end(p, " sectors");
+    shell_print_line(out, row, color);
+}
+
+// Store the file's data once raw and once compressed, then time a cold read of each
+static void bench_lz(const char* path, int* row, uint8_t color){
+    static const char* const raw_copy = "/.bench_raw";
+    static const char* const lz_copy = "/.bench_lz";
+    struct dir_entry raw_e, lz_e;
+
+    int n = fs_read_file(path, scratch_buf, sizeof(scratch_buf));
+    if (n < 0){
+        shell_print_line(fs_strerror(n), row, color);
+        return;
+    }
+    if (fs_write_file_opts(raw_copy, scratch_buf, (uint32_t)n, FS_WRITE_RAW) < 0 ||
+        fs_write_file_opts(lz_copy, scratch_buf, (uint32_t)n, FS_WRITE_COMPRESS) < 0){
+        shell_print_line("Could not write benchmark copies", row, color);
+        return;
+    }
+    fs_stat(raw_copy, &raw_e);
+    fs_stat(lz_copy, &lz_e);
+    if (raw_e.flags & DE_INLINE){
+        shell_print_line("File is small enough to be stored inline", row, color);
+        fs_delete_file(raw_copy);
+        fs_delete_file(lz_copy);
+        return;
+    }
+
+    fs_drop_caches();
+    uint64_t t0 = rdtsc();
+    fs_read_file(raw_copy, scratch_buf, sizeof(scratch_buf));
+    uint64_t t1 = rdtsc();
+
+    fs_drop_caches();
+    uint64_t t2 = rdtsc();
+    fs_read_file(lz_copy, scratch_buf, sizeof(scratch_buf));
+    uint64_t t3 = rdtsc();
+
+    print_timing("raw read: ", t1 - t0, raw_e.sectors, row, color);
+    print_timing("lz read:  ", t3 - t2, lz_e.sectors, row, color);
+    if (!(lz_e.flags & DE_COMPRESSED)){
+        shell_print_line("(data did not compress, both copies are raw)", row, color);
+    }
+
+    fs_delete_file(raw_copy);
+    fs_delete_file(lz_copy);
+}
+
+struct shell_out {
+    int* row;
+    uint8_t color;
+};
+
+static void scrub_report_bad(const char* path, void* ctx){
+    struct shell_out* o = (struct shell_out*)ctx;
+    char out[FS_PATH_MAX + 16];
+    char* p = kstrcpy_end(out, "BAD ");
+    kstrcpy_end(p, path);
+    shell_print_line(out, o->row, vga_entry_color(15, 4));
+}
+
+// KiB per second for `bytes` moved in `cycles`
+static uint64_t kib_per_sec(uint64_t bytes, uint64_t cycles){
+    uint64_t us = timer_cycles_to_us(cycles);
+    if (us == 0) us = 1;
+    uint64_t kib_us = (bytes * 1000000) >> 10;
+    while (us >> 32){
+        us >>= 1;
+        kib_us >>= 1;
+    }
+    return div_u64_u32(kib_us, (uint32_t)us, 0);
+}
+
+// Console for user programs: output goes through the pager, input is raw keys
+static void run_write(const char* s, uint32_t len, void* ctx){
+    struct pager* pg = (struct pager*)ctx;
+    for (uint32_t i = 0; i < len && !pg->quit; ++i){
+        pager_putc(pg, s[i]);
+    }
+}
+
+static int run_getc(void* ctx){
+    (void)ctx;
+    return (unsigned char)get_keyboard_char();
+}
+
+// Sequential read throughput of a whole device, in FS_MAX_FILE_SIZE requests
+static void bench_disk(char* args, int* row, uint8_t color){
+    char* size_arg = split_arg(args);
+    struct blkdev* dev = blkdev_find(args);
+    uint32_t mib = 4;
+
+    if (!dev){
+        shell_print_line("No such device", row, color);
+        return;
+    }
+    if (size_arg){
+        mib = 0;
+        while (*size_arg >= '0' && *size_arg <= '9'){
+            mib = mib * 10 + (uint32_t)(*size_arg++ - '0');
+        }
+        if (mib == 0 || mib > 1024) mib = 4;
+    }
+
+    uint32_t per_req = sizeof(scratch_buf) / SECTOR_SIZE;
+    uint32_t total = mib * 2048;
+    if (total > blk_capacity(dev)) total = blk_capacity(dev) - blk_capacity(dev) % per_req;
+
+    uint64_t t0 = rdtsc();
+    uint32_t done = 0;
+    while (done < total){
+        uint32_t n = (total - done < per_req) ? total - done : per_req;
+        if (blk_read(dev, done, n, scratch_buf) < 0){
+            shell_print_line("Read error", row, vga_entry_color(15, 4));
+            return;
+        }
+        done += n;
+    }
+    uint64_t cycles = rdtsc() - t0;
+
+    char out[80];
+    char* p = kstrcpy_end(out, dev->name);
+    p = kstrcpy_end(p, ": ");
+    p += kutoa(done / 2048, p);
+    p = kstrcpy_end(p, " MiB in ");
+    p += kutoa(div_u64_u32(timer_cycles_to_us(cycles), 1000, 0), p);
+    p = kstrcpy_end(p, " ms, ");
+    p += kutoa(kib_per_sec((uint64_t)done * SECTOR_SIZE, cycles), p);
+    kstrcpy_end(p, " KiB/s");
+    shell_print_line(out, row, color);
+}
+
+// ===== AHCI benchmark =====
+
+#define AHCI_BENCH_OPS      2000
+#define AHCI_BENCH_SEQ_MIB  4
+
+static uint32_t bench_rand(uint32_t* state){
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// Events per second for `n` events in `cycles`
+static uint64_t per_sec(uint64_t n, uint64_t cycles){
+    uint64_t us = timer_cycles_to_us(cycles);
+    if (us == 0) us = 1;
+    n *= 1000000;
+    while (us >> 32){
+        us >>= 1;
+        n >>= 1;
+    }
+    return div_u64_u32(n, (uint32_t)us, 0);
+}
+
+static void bench_ahci_report(const char* label, uint32_t ops, uint64_t bytes, uint64_t cycles, int* row, uint8_t color){
+    char out[80];
+    char* p = kstrcpy_end(out, label);
+    p = kstrcpy_end(p, ": ");
+    p += kutoa(per_sec(ops, cycles), p);
+    p = kstrcpy_end(p, " IOPS, ");
+    p += kutoa(kib_per_sec(bytes, cycles), p);
+    kstrcpy_end(p, " KiB/s");
+    shell_print_line(out, row, color);
+}
+
+// Random single-sector reads through ata_read_sector on ata0, then on sd0
+// one command at a time and with its whole queue in flight; then sequential
+// reads through each path
+static void bench_ahci(char* args, int* row, uint8_t color){
+    struct blkdev* sd = blkdev_find("sd0");
+    struct blkdev* ata = blkdev_find("ata0");
+    uint32_t ops = AHCI_BENCH_OPS;
+
+    if (!sd){
+        shell_print_line("No AHCI disk (make run-ahci attaches one as sd0)", row, color);
+        return;
+    }
+    if (args){
+        ops = 0;
+        while (*args >= '0' && *args <= '9'){
+            ops = ops * 10 + (uint32_t)(*args++ - '0');
+        }
+        if (ops == 0 || ops > 1000000) ops = AHCI_BENCH_OPS;
+    }
+
+    uint32_t span = blk_capacity(sd);
+    if (ata && blk_capacity(ata) < span) span = blk_capacity(ata);
+    uint32_t depth = ahci_queue_depth(sd);
+    uint32_t seq = AHCI_BENCH_SEQ_MIB * 2048;
+    uint32_t per_req = sizeof(scratch_buf) / SECTOR_SIZE;
+    if (seq > span) seq = span - span % per_req;
+    uint32_t seed = 0x2545F491;
+    uint64_t t0, cycles;
+
+    if (ata){
+        t0 = rdtsc();
+        for (uint32_t i = 0; i < ops; ++i){
+            if (ata_read_sector(bench_rand(&seed) % span, scratch_buf) < 0){
+                shell_print_line("Read error on ata0", row, vga_entry_color(15, 4));
+                return;
             }
         }
+        bench_ahci_report("ata_read_sector random", ops, (uint64_t)ops * SECTOR_SIZE, rdtsc() - t0, row, color);
+    }
 
-        else{
-            if (row >= VGA_ROWS){
-                continue;
+    t0 = rdtsc();
+    for (uint32_t i = 0; i < ops; ++i){
+        if (blk_read(sd, bench_rand(&seed) % span, 1, scratch_buf) < 0){
+            shell_print_line("Read error", row, vga_entry_color(15, 4));
+            return;
+        }
+    }
+    bench_ahci_report("sd0 random, QD1", ops, (uint64_t)ops * SECTOR_SIZE, rdtsc() - t0, row, color);
+
+    // submit only waits when every tag is taken, so the queue stays full
+    t0 = rdtsc();
+    int err = 0;
+    for (uint32_t i = 0; i < ops && !err; ++i){
+        uint8_t* buf = scratch_buf + (i % depth) * SECTOR_SIZE;
+        err = sd->ops->submit(sd, 0, bench_rand(&seed) % span, 1, buf) < 0;
+    }
+    if (sd->ops->complete(sd) < 0 || err){
+        shell_print_line("Read error", row, vga_entry_color(15, 4));
+        return;
+    }
+    cycles = rdtsc() - t0;
+    char label[32];
+    kutoa(depth, kstrcpy_end(label, "sd0 random, QD"));
+    bench_ahci_report(label, ops, (uint64_t)ops * SECTOR_SIZE, cycles, row, color);
+
+    if (ata){
+        t0 = rdtsc();
+        for (uint32_t lba = 0; lba < seq; ++lba){
+            if (ata_read_sector(lba, scratch_buf) < 0){
+                shell_print_line("Read error on ata0", row, vga_entry_color(15, 4));
+                return;
             }
-            int idx = row * VGA_COLS + col;
-            VGA_BUFFER[idx] = vga_entry(c, color);
-            col++;
-            if (col >= VGA_COLS){
-                col = 2;
-                row++;
+        }
+        bench_ahci_report("ata_read_sector sequential", seq, (uint64_t)seq * SECTOR_SIZE, rdtsc() - t0, row, color);
+    }
+
+    // every request lands in the same buffer; only the transfer rate matters
+    t0 = rdtsc();
+    for (uint32_t lba = 0; lba < seq && !err; lba += per_req){
+        err = sd->ops->submit(sd, 0, lba, per_req, scratch_buf) < 0;
+    }
+    if (sd->ops->complete(sd) < 0 || err){
+        shell_print_line("Read error", row, vga_entry_color(15, 4));
+        return;
+    }
+    cycles = rdtsc() - t0;
+    bench_ahci_report("sd0 sequential, 64 KiB queued", seq / per_req, (uint64_t)seq * SECTOR_SIZE, cycles, row, color);
+}
+
+// ===== Parallel benchmark =====
+
+#define SMP_BENCH_FILES  256
+#define SMP_BENCH_BYTES  (2 * 1024 * 1024)
+#define SMP_BENCH_WORK   (8 * 1024 * 1024)     // default bytes per measurement
+
+struct smp_job {
+    struct task task;
+    const uint8_t* data;
+    uint32_t len;
+};
+
+// What each CPU computed, padded so CPUs never write the same line
+struct smp_tally {
+    uint64_t bytes;
+    uint64_t packed;
+    uint32_t crc;       // XOR of the files' CRCs, independent of the order they ran in
+} __attribute__((aligned(64)));
+
+static uint8_t smp_arena[SMP_BENCH_BYTES];
+static struct smp_job smp_jobs[SMP_BENCH_FILES];
+static uint32_t smp_job_count;
+static uint32_t smp_arena_used;
+
+static struct smp_tally smp_tally[MAX_CPUS];
+static struct lz_state smp_lz[MAX_CPUS];
+static uint8_t smp_out[MAX_CPUS][FS_MAX_FILE_SIZE];
+
+// One file: checksum it and compress it with this CPU's match finder and buffer
+static void smp_job_run(void* arg){
+    struct smp_job* j = (struct smp_job*)arg;
+    uint32_t cpu = cpu_id();
+    uint32_t n = lz_compress(j->data, j->len, smp_out[cpu], FS_MAX_FILE_SIZE, &smp_lz[cpu]);
+
+    smp_tally[cpu].bytes += j->len;
+    smp_tally[cpu].packed += n ? n : j->len;
+    smp_tally[cpu].crc ^= crc32c(0, j->data, j->len);
+}
+
+// Read every file under `path` into the arena, stopping when either is full
+static void smp_collect(char* path, int len){
+    struct fs_dir d;
+    struct dir_entry e;
+
+    if (fs_opendir(len ? path : "/", &d) < 0) return;
+    while (fs_readdir(&d, &e) > 0 && smp_job_count < SMP_BENCH_FILES){
+        int n = 0;
+        while (e.name[n]) n++;
+        if (len + 1 + n >= FS_PATH_MAX) continue;
+
+        path[len] = '/';
+        for (int k = 0; k <= n; ++k) path[len + 1 + k] = e.name[k];
+
+        if (e.type == FT_DIR){
+            smp_collect(path, len + 1 + n);
+        } else if (e.size > 0 && e.size <= SMP_BENCH_BYTES - smp_arena_used){
+            int r = fs_read_file(path, smp_arena + smp_arena_used, e.size);
+            if (r > 0){
+                struct smp_job* j = &smp_jobs[smp_job_count++];
+                j->task.fn = smp_job_run;
+                j->task.arg = j;
+                j->data = smp_arena + smp_arena_used;
+                j->len = (uint32_t)r;
+                smp_arena_used += (uint32_t)r;
             }
-            update_cursor(row, col);
         }
+        path[len] = '\0';
+    }
+}
+
+// Cycles for `rounds` passes over the jobs on the first `cpus` CPUs
+static uint64_t smp_measure(uint32_t cpus, uint32_t rounds, struct smp_tally* sum){
+    for (int c = 0; c < MAX_CPUS; ++c){
+        smp_tally[c].bytes = 0;
+        smp_tally[c].packed = 0;
+        smp_tally[c].crc = 0;
+    }
+    pool_set_cpus(cpus);
+
+    uint64_t t0 = rdtsc();
+    for (uint32_t r = 0; r < rounds; ++r){
+        for (uint32_t i = 0; i < smp_job_count; ++i){
+            pool_submit(&smp_jobs[i].task);
+        }
+        pool_wait();
+    }
+    uint64_t cycles = rdtsc() - t0;
+
+    sum->bytes = sum->packed = 0;
+    sum->crc = 0;
+    for (int c = 0; c < MAX_CPUS; ++c){
+        sum->bytes += smp_tally[c].bytes;
+        sum->packed += smp_tally[c].packed;
+        sum->crc ^= smp_tally[c].crc;
+    }
+    return cycles;
+}
+
+// Checksum and compress every file on 1, 2, 4... CPUs and compare throughput
+static void bench_smp(char* args, int* row, uint8_t color){
+    char path[FS_PATH_MAX];
+    char out[80];
+    char* p;
+
+    path[0] = '\0';
+    smp_job_count = 0;
+    smp_arena_used = 0;
+    smp_collect(path, 0);
+    if (smp_job_count == 0){
+        shell_print_line("No files to work on", row, color);
+        return;
+    }
+
+    uint32_t rounds = 0;
+    while (args && *args >= '0' && *args <= '9'){
+        rounds = rounds * 10 + (uint32_t)(*args++ - '0');
+    }
+    if (rounds == 0 || rounds > 10000){
+        rounds = SMP_BENCH_WORK / smp_arena_used;
+        if (rounds == 0) rounds = 1;
+        if (rounds > 10000) rounds = 10000;
+    }
+
+    p = out + kutoa(smp_job_count, out);
+    p = kstrcpy_end(p, " files, ");
+    p += kutoa(smp_arena_used, p);
+    p = kstrcpy_end(p, " bytes, ");
+    p += kutoa(rounds, p);
+    kstrcpy_end(p, " rounds");
+    shell_print_line(out, row, color);
+
+    struct smp_tally base = { 0, 0, 0 }, sum;
+    uint64_t base_cycles = 0;
+    uint32_t online = smp_cpu_count();
+    for (uint32_t cpus = 1; ; cpus = (cpus * 2 > online) ? online : cpus * 2){
+        uint64_t cycles = smp_measure(cpus, rounds, &sum);
+        if (cpus == 1){
+            base = sum;
+            base_cycles = cycles;
+        }
+
+        // speedup in hundredths; scale both down until the divisor fits 32 bits
+        uint64_t a = base_cycles * 100, b = cycles;
+        while (b >> 32){
+            a >>= 1;
+            b >>= 1;
+        }
+        uint32_t speedup = (uint32_t)div_u64_u32(a, b ? (uint32_t)b : 1, 0);
+
+        p = out + kutoa(cpus, out);
+        p = kstrcpy_end(p, cpus == 1 ? " cpu:  " : " cpus: ");
+        p += kutoa(kib_per_sec(sum.bytes, cycles), p);
+        p = kstrcpy_end(p, " KiB/s, ");
+        p += kutoa(speedup / 100, p);
+        *p++ = '.';
+        *p++ = (char)('0' + speedup / 10 % 10);
+        *p++ = (char)('0' + speedup % 10);
+        p = kstrcpy_end(p, "x");
+        if (sum.bytes != base.bytes || sum.packed != base.packed || sum.crc != base.crc){
+            kstrcpy_end(p, ", RESULTS DIFFER");
+        }
+        shell_print_line(out, row, color);
+        if (cpus == online) break;
     }
+    pool_set_cpus(online);
+
+    p = kstrcpy_end(out, "compressed to ");
+    p += kutoa(div_u64_u32(base.packed * 100, (uint32_t)(base.bytes ? base.bytes : 1), 0), p);
+    p = kstrcpy_end(p, "%, crc ");
+    khex(p, base.crc);
+    shell_print_line(out, row, color);
+}
 
+static void scrub(int* row, uint8_t color){
+    struct fs_scrub_result res;
+    struct shell_out o = { row, color };
+    char out[80];
+    char* p;
+
+    fs_scrub(&res, scrub_report_bad, &o);
+
+    p = kstrcpy_end(out, "files ");
+    p += kutoa(res.files, p);
+    p = kstrcpy_end(p, ", dirs ");
+    p += kutoa(res.dirs, p);
+    p = kstrcpy_end(p, ", bad ");
+    p += kutoa(res.bad, p);
+    p = kstrcpy_end(p, ", no checksum ");
+    p += kutoa(res.unchecked, p);
+    p = kstrcpy_end(p, ", inline ");
+    kutoa(res.inlined, p);
+    shell_print_line(out, row, color);
+
+    p = kstrcpy_end(out, "read ");
+    p += kutoa(res.bytes, p);
+    p = kstrcpy_end(p, " bytes at ");
+    p += kutoa(kib_per_sec(res.bytes, res.read_cycles), p);
+    kstrcpy_end(p, " KiB/s");
+    shell_print_line(out, row, color);
+
+    p = kstrcpy_end(out, "crc32c (");
+    p = kstrcpy_end(p, crc32c_impl());
+    p = kstrcpy_end(p, ") at ");
+    p += kutoa(kib_per_sec(res.bytes, res.crc_cycles), p);
+    kstrcpy_end(p, " KiB/s");
+    shell_print_line(out, row, color);
 }
 
 void shell(void){
@@ -360,10 +1239,23 @@ void shell(void){
         char line[80];
         int len = 0;
         int col = 2;
-        const char* prompt = "tinyos> ";
+
+        // "tinyos:<cwd>> ", keeping only the tail of a long cwd
+        char prompt[48];
+        const char* cwd = fs_getcwd();
+        int cwd_len = 0;
+        while (cwd[cwd_len]) cwd_len++;
+        char* pp = kstrcpy_end(prompt, "tinyos:");
+        if (cwd_len > 32){
+            pp = kstrcpy_end(pp, "...");
+            cwd += cwd_len - 29;
+        }
+        pp = kstrcpy_end(pp, cwd);
+        pp = kstrcpy_end(pp, "> ");
+        int prompt_len = pp - prompt;
 
         kprint_at(prompt, row, col, color);
-        col += 8; // length of "tinyos> "
+        col += prompt_len;
         update_cursor(row, col);
 
         for (;;){
@@ -373,7 +1265,7 @@ void shell(void){
                 break;
             }
             else if (c == '\b'){
-                if (len > 0 && col > 2 + 8){
+                if (len > 0 && col > 2 + prompt_len){
                     len--;
                     col--;
                     int idx = row * VGA_COLS + col;
@@ -422,15 +1314,46 @@ void shell(void){
         }
 
         if (kstrcmp(cmd, "help") == 0){
-            shell_print_line("Available commands:", &row, color);
-            shell_print_line("  help      - show this help", &row, color);
-            shell_print_line("  clear     - clear the screen", &row, color);
-            shell_print_line("  version   - show version info", &row, color);
-            shell_print_line("  ls        - list files", &row, color);
-            shell_print_line("  cat <f>   - show file contents", &row, color);
-            shell_print_line("  rm <f>    - delete file", &row, color);
-            shell_print_line("  notepad   - open notepad", &row, color);
-            shell_print_line("  q         - return to menu", &row, color);
+            static const char* const help_lines[] = {
+                "Available commands:",
+                "help      - show this help",
+                "clear     - clear the screen",
+                "version   - show version info",
+                "ls [d]    - list a directory",
+                "cd <d>    - change directory",
+                "pwd       - show current directory",
+                "mkdir <d> - create a directory",
+                "cat <f>   - show file contents",
+                "rm <f>    - delete file or empty directory",
+                "stat <f>  - size, storage and compression of a file",
+                "compress <f> on|off - store a file compressed or raw",
+                "bench lz <f> - time raw vs compressed reads",
+                "bench disk <dev> [MiB] - sequential read throughput",
+                "bench ahci [ops] - IOPS of ata_read_sector vs sd0 at QD1 and QD32",
+                "bench smp [rounds] - checksum and compress all files on 1..n CPUs",
+                "cpus      - list the processors",
+                "lsblk     - list block devices",
+                "mkraid <dev> <dev>... - stripe disks into a RAID-0 md device",
+                "mount [dev] - mount a device as the filesystem",
+                "format <dev> - erase a device and mount an empty filesystem",
+                "sync      - write a RAM disk's changes back to its disk",
+                "run <p> [args] - run a user program, e.g. run /bin/sysbench",
+                "scrub     - verify every file's checksum",
+                "stats     - show I/O counters",
+                "trace dump|reset - trace ring over serial",
+                "notepad [f] - open notepad, optionally on a file",
+                "q         - return to menu",
+            };
+            struct pager pg;
+            pager_begin(&pg, row, color);
+            for (uint32_t k = 0; k < sizeof(help_lines) / sizeof(help_lines[0]) && !pg.quit; ++k){
+                if (k > 0){
+                    pager_putc(&pg, ' ');
+                    pager_putc(&pg, ' ');
+                }
+                pager_line(&pg, help_lines[k]);
+            }
+            row = pager_end(&pg);
         }
         else if (kstrcmp(cmd, "clear") == 0){
             clear_screen(color);
@@ -438,7 +1361,7 @@ void shell(void){
             shell_print_line("TinyOS Shell - type 'help' for commands, 'q' to quit", &row, color);
         }
         else if (kstrcmp(cmd, "notepad") == 0){
-            notepad();
+            notepad(arg);
             clear_screen(color);
             row = 1;
             shell_print_line("TinyOS Shell - type 'help' for commands, 'q' to quit", &row, color);
@@ -451,28 +1374,74 @@ void shell(void){
         }
 
         else if (kstrcmp(cmd, "ls") == 0){
-            int any = 0;
-            for (int f = 0; f < MAX_FILES; ++f){
-                if (root_dir[f].used){
-                    shell_print_line(root_dir[f].name, &row, color);
+            struct fs_dir d;
+            int r = fs_opendir(arg ? arg : ".", &d);
+            if (r < 0){
+                shell_print_line(fs_strerror(r), &row, color);
+            } else {
+                struct pager pg;
+                struct dir_entry e;
+                int any = 0;
+
+                pager_begin(&pg, row, color);
+                while (!pg.quit && fs_readdir(&d, &e) > 0){
+                    char out[48];
+                    char* p = kstrcpy_end(out, e.name);
+                    if (e.type == FT_DIR){
+                        p = kstrcpy_end(p, "/");
+                    }
+                    while (p < out + 26){
+                        *p++ = ' ';
+                    }
+                    if (e.type == FT_DIR){
+                        kstrcpy_end(p, "<dir>");
+                    } else {
+                        p += kutoa(e.size, p);
+                        p = kstrcpy_end(p, " bytes");
+                        if (e.flags & DE_INLINE){
+                            kstrcpy_end(p, "  inline");
+                        } else if (e.flags & DE_COMPRESSED){
+                            p = kstrcpy_end(p, "  lz ");
+                            p += kutoa(e.stored * 100 / e.size, p);
+                            kstrcpy_end(p, "%");
+                        }
+                    }
+                    pager_line(&pg, out);
                     any = 1;
                 }
-            }
-            if (!any){
-                shell_print_line("(no files)", &row, color);
+                if (!any){
+                    pager_line(&pg, "(no files)");
+                }
+                row = pager_end(&pg);
             }
         }
         else if (kstrcmp(cmd, "cat") == 0){
+            struct fs_file f;
+            int r;
             if (!arg || arg[0] == '\0'){
                 shell_print_line("Usage: cat <filename>", &row, color);
+            } else if ((r = fs_open(arg, &f)) < 0){
+                shell_print_line(fs_strerror(r), &row, color);
             } else {
-                uint8_t buf[512];
-                int n = fs_read_file(arg, buf, sizeof(buf) - 1);
+                // Pull one sector-sized chunk at a time; the pager blocks on a
+                // key whenever the screen fills, so nothing is read ahead.
+                struct pager pg;
+                uint8_t chunk[SECTOR_SIZE];
+                uint32_t off = 0;
+
+                pager_begin(&pg, row, color);
+                int n = 0;
+                while (!pg.quit){
+                    n = fs_pread(&f, off, chunk, sizeof(chunk));
+                    if (n <= 0) break;
+                    for (int k = 0; k < n && !pg.quit; ++k){
+                        pager_putc(&pg, (char)chunk[k]);
+                    }
+                    off += (uint32_t)n;
+                }
+                row = pager_end(&pg);
                 if (n < 0){
-                    shell_print_line("File not found", &row, color);
-                } else {
-                    buf[n] = '\0';
-                    shell_print_line((char*)buf, &row, color);
+                    shell_print_line(fs_strerror(n), &row, vga_entry_color(15, 4));
                 }
             }
         }
@@ -485,11 +1454,285 @@ void shell(void){
                 if (r == 0){
                     shell_print_line("File deleted", &row, color);
                 } else {
-                    shell_print_line("File not found", &row, color);
+                    shell_print_line(fs_strerror(r), &row, color);
+                }
+            }
+        }
+
+        else if (kstrcmp(cmd, "mkdir") == 0){
+            if (!arg || arg[0] == '\0'){
+                shell_print_line("Usage: mkdir <dir>", &row, color);
+            } else {
+                int r = fs_mkdir(arg);
+                if (r < 0){
+                    shell_print_line(fs_strerror(r), &row, color);
+                }
+            }
+        }
+
+        else if (kstrcmp(cmd, "cd") == 0){
+            int r = fs_chdir(arg ? arg : "/");
+            if (r < 0){
+                shell_print_line(fs_strerror(r), &row, color);
+            }
+        }
+
+        else if (kstrcmp(cmd, "pwd") == 0){
+            shell_print_line(fs_getcwd(), &row, color);
+        }
+
+        else if (kstrcmp(cmd, "stat") == 0){
+            struct dir_entry e;
+            int r;
+            if (!arg){
+                shell_print_line("Usage: stat <path>", &row, color);
+            } else if ((r = fs_stat(arg, &e)) < 0){
+                shell_print_line(fs_strerror(r), &row, color);
+            } else {
+                char out[64];
+                char* p = kstrcpy_end(out, (e.type == FT_DIR) ? "directory, root node " : "file, ");
+                if (e.type == FT_DIR){
+                    kutoa(e.lba, p);
+                    shell_print_line(out, &row, color);
+                } else if (e.flags & DE_INLINE){
+                    p += kutoa(e.size, p);
+                    kstrcpy_end(p, " bytes, inline in the directory record");
+                    shell_print_line(out, &row, color);
+                } else {
+                    p += kutoa(e.size, p);
+                    p = kstrcpy_end(p, " bytes, ");
+                    p += kutoa(e.stored, p);
+                    p = kstrcpy_end(p, " stored in ");
+                    p += kutoa(e.sectors, p);
+                    kstrcpy_end(p, " sectors");
+                    shell_print_line(out, &row, color);
+
+                    p = kstrcpy_end(out, (e.flags & DE_COMPRESSED) ? "lz compressed, ratio " : "raw");
+                    if (e.flags & DE_COMPRESSED){
+                        p += kutoa(e.stored * 100 / e.size, p);
+                        p = kstrcpy_end(p, "%");
+                    }
+                    if (e.flags & DE_NOCOMPRESS){
+                        kstrcpy_end(p, " (compression off)");
+                    }
+                    shell_print_line(out, &row, color);
                 }
             }
         }
 
+        else if (kstrcmp(cmd, "compress") == 0){
+            char* mode = split_arg(arg);
+            int on = mode && kstrcmp(mode, "on") == 0;
+            int off = mode && kstrcmp(mode, "off") == 0;
+            if (!arg || (!on && !off)){
+                shell_print_line("Usage: compress <file> on|off", &row, color);
+            } else {
+                // rewrite the file so the new setting applies to its current data
+                int n = fs_read_file(arg, scratch_buf, sizeof(scratch_buf));
+                if (n >= 0){
+                    n = fs_write_file_opts(arg, scratch_buf, (uint32_t)n,
+                                           on ? FS_WRITE_COMPRESS : FS_WRITE_RAW);
+                }
+                shell_print_line((n < 0) ? fs_strerror(n) : "Done", &row, color);
+            }
+        }
+
+        else if (kstrcmp(cmd, "scrub") == 0){
+            scrub(&row, color);
+        }
+
+        else if (kstrcmp(cmd, "lsblk") == 0){
+            for (int k = 0; k < blkdev_count(); ++k){
+                struct blkdev* dev = blkdev_get(k);
+                char out[80];
+                char* p = kstrcpy_end(out, dev->name);
+                while (p < out + 6){
+                    *p++ = ' ';
+                }
+                p += kutoa(blk_capacity(dev) / 2048, p);
+                p = kstrcpy_end(p, " MiB");
+                while (p < out + 18){
+                    *p++ = ' ';
+                }
+                p = kstrcpy_end(p, (dev == fs_device()) ? "* " : "  ");
+                char* end = p;
+                for (const char* q = dev->info; *q && end < out + 76; ++q){
+                    *end++ = *q;
+                }
+                *end = '\0';
+                shell_print_line(out, &row, color);
+            }
+        }
+
+        else if (kstrcmp(cmd, "mkraid") == 0){
+            struct blkdev* members[STRIPE_MAX_MEMBERS];
+            int n = 0;
+            int bad = 0;
+            char* name = arg;
+            while (name && !bad){
+                char* next = split_arg(name);
+                struct blkdev* dev = blkdev_find(name);
+                if (!dev || n == STRIPE_MAX_MEMBERS){
+                    bad = 1;
+                } else {
+                    members[n++] = dev;
+                }
+                name = next;
+            }
+            struct blkdev* md = (!bad) ? stripe_create(members, n) : 0;
+            if (!md){
+                shell_print_line("Usage: mkraid <dev> <dev>... (2-4 distinct devices)", &row, color);
+            } else {
+                char out[48];
+                char* p = kstrcpy_end(out, "Created ");
+                p = kstrcpy_end(p, md->name);
+                p = kstrcpy_end(p, ", ");
+                p += kutoa(blk_capacity(md) / 2048, p);
+                kstrcpy_end(p, " MiB");
+                shell_print_line(out, &row, color);
+            }
+        }
+
+        else if (kstrcmp(cmd, "run") == 0){
+            char* args = split_arg(arg);
+            if (!arg){
+                shell_print_line("Usage: run <program> [args]", &row, color);
+            } else {
+                struct pager pg;
+                struct user_console con = { run_write, run_getc, &pg };
+                pager_begin(&pg, row, color);
+                int r = user_exec(arg, args, &con);
+                row = pager_end(&pg);
+                if (r < 0){
+                    shell_print_line(user_strerror(r), &row, vga_entry_color(15, 4));
+                } else if (r > 0){
+                    char out[32];
+                    kutoa((uint64_t)r, kstrcpy_end(out, "Exit status "));
+                    shell_print_line(out, &row, color);
+                }
+                enable_cursor(0, 15);
+            }
+        }
+
+        else if (kstrcmp(cmd, "sync") == 0){
+            struct blkdev* dev = fs_device();
+            uint32_t dirty = ramdisk_dirty_sectors(dev);
+            if (blk_flush(dev) < 0){
+                shell_print_line("Sync failed", &row, vga_entry_color(15, 4));
+            } else {
+                char out[48];
+                char* p = kstrcpy_end(out, "Synced ");
+                p = kstrcpy_end(p, dev->name);
+                p = kstrcpy_end(p, ", ");
+                p += kutoa(dirty - ramdisk_dirty_sectors(dev), p);
+                kstrcpy_end(p, " sectors written back");
+                shell_print_line(out, &row, color);
+            }
+        }
+
+        else if (kstrcmp(cmd, "mount") == 0){
+            if (!arg){
+                shell_print_line(fs_device()->name, &row, color);
+            } else {
+                struct blkdev* dev = blkdev_find(arg);
+                if (!dev){
+                    shell_print_line("No such device", &row, color);
+                } else {
+                    struct blkdev* prev = fs_device();
+                    int r = fs_mount(dev);
+                    if (r < 0){
+                        shell_print_line(fs_strerror(r), &row, color);
+                        fs_mount(prev);
+                    } else {
+                        shell_print_line("Mounted", &row, color);
+                    }
+                }
+            }
+        }
+
+        else if (kstrcmp(cmd, "format") == 0){
+            struct blkdev* dev = arg ? blkdev_find(arg) : 0;
+            if (!dev){
+                shell_print_line("Usage: format <dev>", &row, color);
+            } else {
+                struct blkdev* prev = fs_device();
+                int r = fs_format(dev);
+                if (r < 0){
+                    shell_print_line(fs_strerror(r), &row, color);
+                    fs_mount(prev);
+                } else {
+                    shell_print_line("Formatted and mounted", &row, color);
+                }
+            }
+        }
+
+        else if (kstrcmp(cmd, "bench") == 0){
+            char* target = split_arg(arg);
+            if (arg && target && kstrcmp(arg, "lz") == 0){
+                bench_lz(target, &row, color);
+            } else if (arg && target && kstrcmp(arg, "disk") == 0){
+                bench_disk(target, &row, color);
+            } else if (arg && kstrcmp(arg, "smp") == 0){
+                bench_smp(target, &row, color);
+            } else if (arg && kstrcmp(arg, "ahci") == 0){
+                bench_ahci(target, &row, color);
+            } else {
+                shell_print_line("Usage: bench lz <f> | disk <dev> [MiB] | smp [rounds] | ahci [ops]", &row, color);
+            }
+        }
+
+        else if (kstrcmp(cmd, "cpus") == 0){
+            char out[48];
+            char* p;
+            for (uint32_t c = 0; c < smp_cpu_count(); ++c){
+                p = kstrcpy_end(out, "cpu");
+                p += kutoa(c, p);
+                p = kstrcpy_end(p, "  apic ");
+                p += kutoa(percpu[c].apic_id, p);
+                if (c == 0) kstrcpy_end(p, "  boot");
+                shell_print_line(out, &row, color);
+            }
+            p = out + kutoa(smp_cpu_count(), out);
+            p = kstrcpy_end(p, " online, found via ");
+            kstrcpy_end(p, smp_table_source());
+            shell_print_line(out, &row, color);
+        }
+
+        else if (kstrcmp(cmd, "stats") == 0){
+            struct pager pg;
+            char out[64];
+            pager_begin(&pg, row, color);
+            for (int c = 0; c < CTR_COUNT && !pg.quit; ++c){
+                char* p = kstrcpy_end(out, trace_counter_names[c]);
+                while (p < out + 26){
+                    *p++ = ' ';
+                }
+                kutoa(trace_counter_total((enum trace_counter)c), p);
+                pager_line(&pg, out);
+            }
+            char* p = kstrcpy_end(out, "tsc_hz                    ");
+            kutoa(tsc_hz, p);
+            pager_line(&pg, out);
+            row = pager_end(&pg);
+        }
+
+        else if (kstrcmp(cmd, "trace") == 0){
+            if (arg && kstrcmp(arg, "dump") == 0){
+                char out[48];
+                char* p = kstrcpy_end(out, "Streaming ");
+                p += kutoa(trace_records_held(), p);
+                kstrcpy_end(p, " records to COM1...");
+                shell_print_line(out, &row, color);
+                trace_dump_serial();
+                shell_print_line("Done", &row, color);
+            } else if (arg && kstrcmp(arg, "reset") == 0){
+                trace_reset();
+                shell_print_line("Counters and trace ring cleared", &row, color);
+            } else {
+                shell_print_line("Usage: trace dump|reset", &row, color);
+            }
+        }
+
         else if (kstrcmp(cmd, "q") == 0){
             disable_cursor();
             main_menu();
@@ -518,26 +1761,74 @@ struct idt_ptr{
     uint32_t base;
 } __attribute__((packed));
 
+// What isr_common in boot.s leaves on the stack; user_esp/user_ss only
+// exist when the exception came from ring 3
+struct trap_frame{
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;   // pushad
+    uint32_t vector;
+    uint32_t error;
+    uint32_t eip, cs, eflags;
+    uint32_t user_esp, user_ss;
+};
+
+#define EFLAGS_TF 0x100     // single-step
+
 static struct idt_entry idt[256] __attribute__((aligned(8)));
 static struct idt_ptr idtp __attribute__((aligned(8)));
 
 // Assembly functions
 extern void idt_load(uint32_t);
-extern void isr0(void);
+extern const uint32_t isr_stub_table[32];
+extern void syscall_int80(void);
+extern void sysenter_entry(void);
+extern void ipi_wake(void);
+extern void lapic_spurious(void);
+
+static const char* const exception_names[32] = {
+    "divide error", "debug", "NMI", "breakpoint", "overflow", "bound range",
+    "invalid opcode", "no FPU", "double fault", "FPU overrun", "invalid TSS",
+    "segment not present", "stack fault", "general protection", "page fault",
+    "reserved", "FPU error", "alignment check", "machine check", "SIMD error",
+};
 
 /* C-level ISR handler */
-// void isr0_c(void){
-//     uint8_t color = vga_entry_color(15, 4); // white on red
-//     kprint_at(">>> INT 0 FIRED! <<<", 16, 2, color);
-        // Halt after handling
-//     for(;;) __asm__ __volatile__("hlt");
-// }
-
-static void idt_set_gate(int n, uint32_t handler){
+void isr_c(struct trap_frame* f){
+    uint32_t cr2;
+    __asm__ __volatile__("mov %%cr2, %0" : "=r"(cr2));
+
+    if ((f->cs & 3) == 3){
+        user_fault(f->vector, f->eip, f->error, cr2);
+    }
+
+    // A user program that set TF before SYSENTER traps on the first kernel
+    // instruction; drop the flag and let the system call run
+    if (f->vector == 1 && f->eip == (uint32_t)sysenter_entry){
+        f->eflags &= ~EFLAGS_TF;
+        return;
+    }
+
+    // A fault in the kernel itself: show where and stop
+    uint8_t color = vga_entry_color(15, 4); // white on red
+    char out[80];
+    char* p = kstrcpy_end(out, "Kernel exception: ");
+    kstrcpy_end(p, exception_names[f->vector] ? exception_names[f->vector] : "reserved");
+    clear_screen(color);
+    kprint_at(out, 1, 2, color);
+    p = kstrcpy_end(out, "eip ");
+    p = khex(p, f->eip);
+    p = kstrcpy_end(p, "  error ");
+    p = khex(p, f->error);
+    p = kstrcpy_end(p, "  cr2 ");
+    khex(p, cr2);
+    kprint_at(out, 2, 2, color);
+    for(;;) __asm__ __volatile__("cli; hlt");
+}
+
+static void idt_set_gate(int n, uint32_t handler, uint8_t type_attr){
     idt[n].offset_low  = handler & 0xFFFF;
-    idt[n].selector    = 0x10;      // kernel code segment
+    idt[n].selector    = GDT_KERNEL_CODE;
     idt[n].zero        = 0;
-    idt[n].type_attr   = 0x8E;      // present, ring 0, 32-bit interrupt gate
+    idt[n].type_attr   = type_attr;
     idt[n].offset_high = (handler >> 16) & 0xFFFF;
 }
 
@@ -557,9 +1848,16 @@ static void idt_init(void){
 
     // Install ISR handlers for CPU exceptions (0-31)
     for (int i = 0; i < 32; ++i) {
-        idt_set_gate(i, (uint32_t)isr0);
+        idt_set_gate(i, isr_stub_table[i], 0x8E);      // present, ring 0, 32-bit interrupt gate
     }
 
+    // The system call gate is the only one ring 3 may invoke
+    idt_set_gate(SYSCALL_VECTOR, (uint32_t)syscall_int80, 0xEE);
+
+    // Only the APs ever enable interrupts, to be woken from hlt (src/pool.c)
+    idt_set_gate(IPI_WAKE_VECTOR, (uint32_t)ipi_wake, 0x8E);
+    idt_set_gate(LAPIC_SPURIOUS_VECTOR, (uint32_t)lapic_spurious, 0x8E);
+
     // Load the IDT
     idt_load((uint32_t)&idtp);
 }
@@ -572,10 +1870,7 @@ void main_menu(void) {
         kprint_at("Welcome to my TinyOS kernel!", 1, 2, color);
         kprint_at("TinyOS Main Menu", 3, 2, color);
 
-        // Set up IDT
-        // idt_init();
-        // kprint_at("IDT initialized successfully!", 13, 2, color);
-        
+        // IDT test: kernel_main installs the IDT, so this should bring up the exception screen
         // kprint_at("Triggering INT 0 (divide by zero)...", 14, 2, color);
 
         // Trigger interrupt 0
@@ -593,7 +1888,7 @@ void main_menu(void) {
         char c = get_keyboard_char();
 
         if (c == 'n' || c == 'N') {
-            notepad();
+            notepad(0);
         }
         if (c == 's' || c == 'S') {
             shell();
@@ -601,8 +1896,177 @@ void main_menu(void) {
     }
 }
 
-void kernel_main(void){
-    fs_init();
+// Find "key=value" among the space-separated words of a command line
+static int cmdline_get(const char* cmdline, const char* key, char* out, int cap){
+    const char* p = cmdline;
+    while (*p){
+        while (*p == ' ') p++;
+        const char* k = key;
+        while (*k && *p == *k){
+            p++;
+            k++;
+        }
+        if (*k == '\0' && *p == '='){
+            int n = 0;
+            p++;
+            while (*p && *p != ' ' && n < cap - 1){
+                out[n++] = *p++;
+            }
+            out[n] = '\0';
+            return 1;
+        }
+        while (*p && *p != ' ') p++;
+    }
+    return 0;
+}
+
+static int cmdline_has_word(const char* cmdline, const char* word){
+    const char* p = cmdline;
+    while (*p){
+        while (*p == ' ') p++;
+        const char* w = word;
+        while (*w && *p == *w){
+            p++;
+            w++;
+        }
+        if (*w == '\0' && (*p == ' ' || *p == '\0')) return 1;
+        while (*p && *p != ' ') p++;
+    }
+    return 0;
+}
+
+// The module tagged "ramdisk" in grub.cfg becomes ram0, used where GRUB put it
+static void boot_modules(const struct multiboot_info* mbi){
+    const struct multiboot_module* mods = (const struct multiboot_module*)mbi->mods_addr;
+    for (uint32_t i = 0; i < mbi->mods_count; ++i){
+        const char* name = mods[i].string ? (const char*)mods[i].string : "";
+        if (cmdline_has_word(name, "ramdisk")){
+            ramdisk_create((void*)mods[i].mod_start, mods[i].mod_end - mods[i].mod_start);
+        }
+    }
+}
+
+// Modules tagged "install=<path>" are executables (user/*.elf) copied into
+// the filesystem, skipping the write when the file already matches
+static void boot_install(const struct multiboot_info* mbi){
+    const struct multiboot_module* mods = (const struct multiboot_module*)mbi->mods_addr;
+    for (uint32_t i = 0; i < mbi->mods_count; ++i){
+        char path[FS_PATH_MAX];
+        const char* name = mods[i].string ? (const char*)mods[i].string : "";
+        if (!cmdline_get(name, "install", path, sizeof(path))) continue;
+
+        const uint8_t* data = (const uint8_t*)mods[i].mod_start;
+        uint32_t size = mods[i].mod_end - mods[i].mod_start;
+        if (size > sizeof(scratch_buf)) continue;
+
+        int n = fs_read_file(path, scratch_buf, sizeof(scratch_buf));
+        int same = (n == (int)size);
+        for (uint32_t k = 0; same && k < size; ++k){
+            same = scratch_buf[k] == data[k];
+        }
+        if (same) continue;
+
+        // create the parent directories
+        for (int k = 1; path[k]; ++k){
+            if (path[k] == '/'){
+                path[k] = '\0';
+                fs_mkdir(path);
+                path[k] = '/';
+            }
+        }
+        fs_write_file(path, data, size);
+    }
+}
+
+// Kernel command line switches:
+//   root=<dev>       device to mount (default ata0): ata0..ata3, sd0..sd3, ram0 or md0
+//   raid=<a>,<b>...  stripe these devices into md0 before mounting
+//   ramsync=<dev>    write ram0's changes back to <dev> on `sync`
+//   nosmp            leave the other processors stopped
+//   format           format the root device if it holds no filesystem
+static struct blkdev* boot_root_device(const char* cmdline, char* root, int cap){
+    char value[32];
+
+    if (cmdline_get(cmdline, "raid", value, sizeof(value))){
+        struct blkdev* members[STRIPE_MAX_MEMBERS];
+        int n = 0;
+        char* p = value;
+        while (*p && n < STRIPE_MAX_MEMBERS){
+            char* name = p;
+            while (*p && *p != ',') p++;
+            if (*p) *p++ = '\0';
+            struct blkdev* dev = blkdev_find(name);
+            if (dev) members[n++] = dev;
+        }
+        stripe_create(members, n);
+    }
+
+    if (cmdline_get(cmdline, "ramsync", value, sizeof(value))){
+        ramdisk_set_backing(blkdev_find("ram0"), blkdev_find(value));
+    }
+
+    if (!cmdline_get(cmdline, "root", root, cap)){
+        kstrcpy_end(root, "ata0");
+    }
+    return blkdev_find(root);
+}
+
+// 1 if the superblock and the old flat directory are all zeros: nothing that
+// could be someone's data is lost by formatting
+static int disk_is_blank(struct blkdev* dev){
+    if (blk_read(dev, 0, DATA_START_LBA, scratch_buf) < 0) return 0;
+    for (uint32_t i = 0; i < DATA_START_LBA * SECTOR_SIZE; ++i){
+        if (scratch_buf[i]) return 0;
+    }
+    return 1;
+}
+
+// boot.s passes the bootloader's eax and ebx
+void kernel_main(uint32_t magic, const struct multiboot_info* mbi){
+    gdt_init();
+    idt_init();
+    paging_init();
+    user_init();
+    serial_init();
+    timer_init();
+    crc32c_init();
+    ata_init();
+    ahci_init();
+
+    const char* cmdline = "";
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC){
+        if (mbi->flags & MB_INFO_CMDLINE) cmdline = (const char*)mbi->cmdline;
+        if (mbi->flags & MB_INFO_MODS) boot_modules(mbi);
+    }
+
+    char root_name[16];
+    struct blkdev* root = boot_root_device(cmdline, root_name, sizeof(root_name));
+    int r = root ? fs_mount(root) : FS_ENOENT;
+    if (r == FS_ENOFS && (disk_is_blank(root) || cmdline_has_word(cmdline, "format"))){
+        r = fs_format(root);
+    }
+    if (r < 0){
+        uint8_t color = vga_entry_color(15, 4);
+        char out[48];
+        clear_screen(color);
+        kstrcpy_end(kstrcpy_end(out, "Cannot mount root device "), root_name);
+        kprint_at(out, 1, 2, color);
+        kprint_at(root ? fs_strerror(r) : "No such device", 2, 2, color);
+        if (r == FS_ENOFS){
+            kprint_at("Add `format` to the kernel command line to erase it", 3, 2, color);
+        }
+        for (;;){
+            __asm__ __volatile__("cli; hlt");
+        }
+    }
+    if (magic == MULTIBOOT_BOOTLOADER_MAGIC && (mbi->flags & MB_INFO_MODS)){
+        boot_install(mbi);
+    }
+
+    // last: the AP start-up code borrows low memory GRUB may have used
+    if (!cmdline_has_word(cmdline, "nosmp")){
+        smp_init();
+    }
     main_menu();
 
     for (;;){
@@ -0,0 +1,165 @@
+#include "percpu.h"
+#include "acpi.h"
+#include "kstring.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define BIOS_EBDA_SEG_PTR   0x40E       // real-mode segment of the EBDA
+#define BIOS_ROM_START      0xE0000
+#define BIOS_ROM_END        0x100000
+
+#define MADT_LAPIC          0           // processor local APIC entry
+#define MADT_LAPIC_ADDR     5           // 64-bit local APIC address override
+#define MADT_ENABLED        0x1
+#define MADT_ONLINE_CAPABLE 0x2
+
+#define MP_PROCESSOR        0
+#define MP_ENABLED          0x1
+
+struct rsdp {
+    char     signature[8];              // "RSD PTR "
+    uint8_t  checksum;
+    char     oem[6];
+    uint8_t  revision;
+    uint32_t rsdt;
+} __attribute__((packed));
+
+struct sdt_header {
+    char     signature[4];
+    uint32_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem[6];
+    char     oem_table[8];
+    uint32_t oem_revision;
+    uint32_t creator;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct madt {
+    struct sdt_header h;
+    uint32_t lapic_base;
+    uint32_t flags;
+    // variable-length entries follow, each starting with type and length
+} __attribute__((packed));
+
+struct mp_float {
+    char     signature[4];              // "_MP_"
+    uint32_t config;
+    uint8_t  length;                    // in 16-byte units
+    uint8_t  revision;
+    uint8_t  checksum;
+    uint8_t  features[5];
+} __attribute__((packed));
+
+struct mp_config {
+    char     signature[4];              // "PCMP"
+    uint16_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem[20];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entries;
+    uint32_t lapic_base;
+    uint16_t ext_length;
+    uint8_t  ext_checksum;
+    uint8_t  reserved;
+} __attribute__((packed));
+
+static int checksum_ok(const void* p, uint32_t len) {
+    const uint8_t* b = (const uint8_t*)p;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; ++i) sum += b[i];
+    return sum == 0;
+}
+
+// Both tables are found by a signature on a 16-byte boundary in the first KiB
+// of the EBDA or in the BIOS ROM area
+static const void* bios_search(const char* sig, uint32_t len) {
+    uint16_t seg;
+    memcpy(&seg, (const void*)BIOS_EBDA_SEG_PTR, sizeof(seg));   // gcc rejects a direct read from page 0
+    uint32_t ebda = (uint32_t)seg << 4;
+    uint32_t ranges[2][2] = {
+        { ebda, ebda + 1024 },
+        { BIOS_ROM_START, BIOS_ROM_END },
+    };
+
+    for (int r = 0; r < 2; ++r) {
+        if (ranges[r][0] == 0) continue;
+        for (uint32_t a = ranges[r][0]; a + len <= ranges[r][1]; a += 16) {
+            if (memcmp((const void*)a, sig, 4) == 0 && checksum_ok((const void*)a, len)) {
+                return (const void*)a;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void add_cpu(struct cpu_table* out, uint8_t apic_id) {
+    if (out->count < MAX_CPUS) out->apic_id[out->count++] = apic_id;
+}
+
+static int madt_scan(struct cpu_table* out) {
+    // the signature is 8 bytes, the checksum covers the first 20
+    const struct rsdp* rp = (const struct rsdp*)bios_search("RSD ", sizeof(struct rsdp));
+    if (!rp || memcmp(rp->signature, "RSD PTR ", 8) != 0) return 0;
+
+    const struct sdt_header* rsdt = (const struct sdt_header*)rp->rsdt;
+    if (memcmp(rsdt->signature, "RSDT", 4) != 0 || !checksum_ok(rsdt, rsdt->length)) return 0;
+
+    const uint32_t* tables = (const uint32_t*)(rsdt + 1);
+    uint32_t n = (rsdt->length - sizeof(*rsdt)) / 4;
+    for (uint32_t i = 0; i < n; ++i) {
+        const struct madt* m = (const struct madt*)tables[i];
+        if (memcmp(m->h.signature, "APIC", 4) != 0 || !checksum_ok(m, m->h.length)) continue;
+
+        out->lapic_base = m->lapic_base;
+        const uint8_t* e = (const uint8_t*)(m + 1);
+        const uint8_t* end = (const uint8_t*)m + m->h.length;
+        while (e + 2 <= end && e[1] >= 2) {
+            if (e[0] == MADT_LAPIC && e[1] >= 8) {
+                uint32_t flags = *(const uint32_t*)(e + 4);
+                if (flags & (MADT_ENABLED | MADT_ONLINE_CAPABLE)) add_cpu(out, e[3]);
+            } else if (e[0] == MADT_LAPIC_ADDR && e[1] >= 12 && *(const uint32_t*)(e + 8) == 0) {
+                out->lapic_base = *(const uint32_t*)(e + 4);
+            }
+            e += e[1];
+        }
+        out->source = "acpi";
+        return out->count;
+    }
+    return 0;
+}
+
+static int mp_scan(struct cpu_table* out) {
+    const struct mp_float* fp = (const struct mp_float*)bios_search("_MP_", sizeof(struct mp_float));
+    if (!fp || fp->config == 0) return 0;      // default configurations are not supported
+
+    const struct mp_config* c = (const struct mp_config*)fp->config;
+    if (memcmp(c->signature, "PCMP", 4) != 0 || !checksum_ok(c, c->length)) return 0;
+
+    out->lapic_base = c->lapic_base;
+    const uint8_t* e = (const uint8_t*)(c + 1);
+    for (uint32_t i = 0; i < c->entries; ++i) {
+        if (e[0] == MP_PROCESSOR) {
+            if (e[3] & MP_ENABLED) add_cpu(out, e[1]);
+            e += 20;
+        } else {
+            e += 8;                             // buses, I/O APICs and interrupt routes
+        }
+    }
+    out->source = "mp";
+    return out->count;
+}
+
+int acpi_find_cpus(struct cpu_table* out) {
+    memset(out, 0, sizeof(*out));
+    out->lapic_base = LAPIC_DEFAULT_BASE;
+    out->source = "none";
+
+    if (madt_scan(out) > 0) return out->count;
+    out->count = 0;
+    out->lapic_base = LAPIC_DEFAULT_BASE;
+    return mp_scan(out);
+}
@@ -0,0 +1,23 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include "percpu.h"
+
+#define LAPIC_DEFAULT_BASE  0xFEE00000u
+
+// Processors the firmware reports as usable, by local APIC ID. `source` is
+// "acpi" for the MADT or "mp" for the older Intel MP table.
+struct cpu_table {
+    uint32_t lapic_base;
+    int count;
+    uint8_t apic_id[MAX_CPUS];
+    const char* source;
+};
+
+// Find the CPUs in the ACPI MADT, falling back to the MP configuration
+// table. Returns the number found (0 when neither table exists) and stops
+// at MAX_CPUS.
+int acpi_find_cpus(struct cpu_table* out);
+
+#endif
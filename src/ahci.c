@@ -0,0 +1,599 @@
+#include "ahci.h"
+#include "pci.h"
+#include "paging.h"
+#include "blkdev.h"
+#include "ata.h"
+#include "timer.h"
+#include "trace.h"
+#include "kstring.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define PCI_CLASS_STORAGE   0x01
+#define PCI_SUBCLASS_SATA   0x06
+#define PCI_PROGIF_AHCI     0x01
+#define AHCI_ABAR           5           // BAR holding the HBA registers
+#define AHCI_ABAR_SIZE      0x1100      // generic registers plus 32 ports
+
+// HBA registers, as byte offsets from the ABAR
+#define HBA_CAP             0x00
+#define HBA_GHC             0x04
+#define HBA_PI              0x0C
+#define HBA_CAP2            0x24
+#define HBA_BOHC            0x28
+#define HBA_PORT(i)         (0x100 + 0x80 * (i))
+
+#define CAP_NCS(cap)        ((((cap) >> 8) & 0x1F) + 1)
+#define CAP_SSS             (1u << 27)
+#define CAP_SNCQ            (1u << 30)
+#define CAP2_BOH            (1u << 0)
+#define BOHC_BOS            (1u << 0)
+#define BOHC_OOS            (1u << 1)
+#define GHC_AE              (1u << 31)
+
+// Port registers, from the port's base
+#define PX_CLB              0x00
+#define PX_CLBU             0x04
+#define PX_FB               0x08
+#define PX_FBU              0x0C
+#define PX_IS               0x10
+#define PX_IE               0x14
+#define PX_CMD              0x18
+#define PX_TFD              0x20
+#define PX_SIG              0x24
+#define PX_SSTS             0x28
+#define PX_SCTL             0x2C
+#define PX_SERR             0x30
+#define PX_SACT             0x34
+#define PX_CI               0x38
+
+#define PXCMD_ST            (1u << 0)
+#define PXCMD_SUD           (1u << 1)
+#define PXCMD_FRE           (1u << 4)
+#define PXCMD_FR            (1u << 14)
+#define PXCMD_CR            (1u << 15)
+#define PXIS_FATAL          0x78000000  // task file, host bus data/fatal, interface errors
+#define SSTS_DET_PRESENT    0x3
+#define SIG_ATA             0x00000101
+#define TFD_BUSY            (ATA_STATUS_BSY | ATA_STATUS_DRQ)
+
+#define FIS_TYPE_H2D        0x27
+#define FIS_H2D_COMMAND     0x80
+#define FIS_DEV_LBA         0x40
+#define HDR_CFL             5           // command FIS length in dwords
+#define HDR_WRITE           (1u << 6)
+
+#define ATA_CMD_READ_DMA_EXT    0x25
+#define ATA_CMD_WRITE_DMA_EXT   0x35
+#define ATA_CMD_READ_FPDMA      0x60
+#define ATA_CMD_WRITE_FPDMA     0x61
+#define ATA_CMD_FLUSH_EXT       0xEA
+#define ATA_CMD_READ_LOG_EXT    0x2F
+#define ATA_LOG_NCQ_ERROR       0x10    // log address of the NCQ command error page
+
+#define PRD_MAX_BYTES       (4u << 20)
+#define PAGE_BYTES          4096u
+#define PORT_TIMEOUT_MS     500
+#define CMD_TIMEOUT_MS      5000
+
+struct cmd_header {
+    uint16_t flags;                     // FIS length, write bit
+    uint16_t prdtl;                     // PRD entries in the table
+    uint32_t prdbc;                     // bytes moved, written by the HBA
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t reserved[4];
+};
+
+struct prd {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc;                       // byte count - 1
+};
+
+struct cmd_table {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    struct prd prdt[AHCI_PRDS];
+} __attribute__((aligned(128)));
+
+// Everything the HBA reads or writes for one port: the command list, the
+// FIS receive area and a command table per slot
+struct port_mem {
+    struct cmd_header list[AHCI_SLOTS];
+    uint8_t fis[256];
+    struct cmd_table tables[AHCI_SLOTS];
+} __attribute__((aligned(1024)));
+
+_Static_assert(sizeof(struct cmd_header) == 32, "cmd_header is 32 bytes");
+_Static_assert(offsetof(struct port_mem, fis) % 256 == 0, "the FIS area must be 256-byte aligned");
+
+struct ahci_disk {
+    struct blkdev dev;
+    uint8_t* regs;                      // this port's registers
+    struct port_mem* mem;
+    uint8_t  index;
+    uint8_t  ncq;
+    uint8_t  failed;                    // a command failed since the last complete
+    uint32_t sectors;
+    uint32_t depth;                     // tags this disk may use, 1 without NCQ
+    uint32_t slots;                     // mask of those tags
+    uint32_t busy;                      // tags issued and not yet reaped
+    struct {
+        uint32_t lba;
+        uint32_t count;
+        uint64_t start;
+        uint8_t  write;
+    } req[AHCI_SLOTS];
+    char name[4];
+    char info[56];
+};
+
+static struct ahci_disk disks[AHCI_MAX_DISKS];
+static struct port_mem port_mem[AHCI_MAX_DISKS];
+static int disk_count;
+
+static uint16_t identify_buf[256] __attribute__((aligned(16)));
+static uint8_t ncq_log[SECTOR_SIZE] __attribute__((aligned(16)));
+static uint8_t bounce[AHCI_MAX_XFER * SECTOR_SIZE] __attribute__((aligned(16)));
+
+static uint32_t hba_read(uint8_t* hba, uint32_t reg) {
+    return *(volatile uint32_t*)(hba + reg);
+}
+
+static void hba_write(uint8_t* hba, uint32_t reg, uint32_t v) {
+    *(volatile uint32_t*)(hba + reg) = v;
+}
+
+static uint32_t port_read(struct ahci_disk* d, uint32_t reg) {
+    return *(volatile uint32_t*)(d->regs + reg);
+}
+
+// The memory clobber keeps command table stores ahead of the doorbell write
+static void port_write(struct ahci_disk* d, uint32_t reg, uint32_t v) {
+    __asm__ __volatile__ ("" : : : "memory");
+    *(volatile uint32_t*)(d->regs + reg) = v;
+}
+
+static uint64_t deadline_ms(uint32_t ms) {
+    return rdtsc() + div_u64_u32(tsc_hz, 1000, 0) * ms;
+}
+
+// Poll until (reg & mask) == want
+static int port_wait(struct ahci_disk* d, uint32_t reg, uint32_t mask, uint32_t want, uint32_t ms) {
+    uint64_t end = deadline_ms(ms);
+    while ((port_read(d, reg) & mask) != want) {
+        if (rdtsc() > end) return -1;
+        __asm__ __volatile__ ("pause");
+    }
+    return 0;
+}
+
+static int port_stop(struct ahci_disk* d) {
+    port_write(d, PX_CMD, port_read(d, PX_CMD) & ~PXCMD_ST);
+    if (port_wait(d, PX_CMD, PXCMD_CR, 0, PORT_TIMEOUT_MS) < 0) return -1;
+    port_write(d, PX_CMD, port_read(d, PX_CMD) & ~PXCMD_FRE);
+    return port_wait(d, PX_CMD, PXCMD_FR, 0, PORT_TIMEOUT_MS);
+}
+
+static int port_start(struct ahci_disk* d) {
+    port_write(d, PX_CMD, port_read(d, PX_CMD) | PXCMD_FRE);
+    if (port_wait(d, PX_TFD, TFD_BUSY, 0, PORT_TIMEOUT_MS) < 0) return -1;
+    port_write(d, PX_CMD, port_read(d, PX_CMD) | PXCMD_ST);
+    return 0;
+}
+
+static int port_issue(struct ahci_disk* d, uint32_t tag, uint8_t cmd, uint32_t lba, uint32_t count,
+                      void* buf, uint32_t bytes, int write, int queued);
+
+static void port_comreset(struct ahci_disk* d) {
+    port_write(d, PX_SCTL, (port_read(d, PX_SCTL) & ~0xFu) | 1);
+    timer_delay_us(1000);
+    port_write(d, PX_SCTL, port_read(d, PX_SCTL) & ~0xFu);
+    port_wait(d, PX_SSTS, 0xF, SSTS_DET_PRESENT, PORT_TIMEOUT_MS);
+    port_write(d, PX_SERR, 0xFFFFFFFF);
+}
+
+// After a failed queued command the drive refuses further FPDMA commands
+// until its NCQ error log is read. Runs on slot 0 with the port restarted.
+static int port_read_ncq_log(struct ahci_disk* d) {
+    d->req[0].count = 0;
+    if (port_issue(d, 0, ATA_CMD_READ_LOG_EXT, ATA_LOG_NCQ_ERROR, 1, ncq_log, sizeof(ncq_log), 0, 0) < 0) {
+        return -1;
+    }
+    if (port_wait(d, PX_CI, 1, 0, CMD_TIMEOUT_MS) < 0) return -1;
+    return (port_read(d, PX_IS) & PXIS_FATAL) ? -1 : 0;
+}
+
+// After an error the HBA stops processing the port. Everything in flight is
+// lost: restart the port, clear a queued error with the NCQ log read, and
+// reset the link if the drive is still busy or the log read fails too.
+static void port_recover(struct ahci_disk* d) {
+    port_write(d, PX_CMD, port_read(d, PX_CMD) & ~PXCMD_ST);
+    port_wait(d, PX_CMD, PXCMD_CR, 0, PORT_TIMEOUT_MS);
+    port_write(d, PX_SERR, 0xFFFFFFFF);
+    port_write(d, PX_IS, 0xFFFFFFFF);
+
+    int reset = (port_read(d, PX_TFD) & TFD_BUSY) != 0;
+    if (!reset && d->ncq) {
+        reset = port_start(d) < 0 || port_read_ncq_log(d) < 0;
+        if (reset) {
+            port_write(d, PX_CMD, port_read(d, PX_CMD) & ~PXCMD_ST);
+            port_wait(d, PX_CMD, PXCMD_CR, 0, PORT_TIMEOUT_MS);
+            port_write(d, PX_IS, 0xFFFFFFFF);
+        }
+    } else if (!reset) {
+        port_start(d);
+    }
+    if (reset) {
+        port_comreset(d);
+        port_start(d);
+    }
+
+    d->busy = 0;
+    d->failed = 1;
+}
+
+// Scatter-gather list for `bytes` at `buf`: one entry per physically
+// contiguous run, which is the whole buffer for kernel memory and may be
+// several pages for a buffer in the user window
+static int build_prdt(struct cmd_table* t, void* buf, uint32_t bytes) {
+    uint8_t* p = (uint8_t*)buf;
+    int n = 0;
+
+    while (bytes > 0) {
+        uint32_t phys = paging_phys(p);
+        uint32_t run = PAGE_BYTES - (phys & (PAGE_BYTES - 1));
+        if (run > bytes) run = bytes;
+
+        while (run < bytes && paging_phys(p + run) == phys + run) {
+            uint32_t more = (bytes - run < PAGE_BYTES) ? bytes - run : PAGE_BYTES;
+            if (run + more > PRD_MAX_BYTES) break;
+            run += more;
+        }
+        if (n == AHCI_PRDS) return -1;
+
+        t->prdt[n].dba = phys;
+        t->prdt[n].dbau = 0;
+        t->prdt[n].reserved = 0;
+        t->prdt[n].dbc = run - 1;
+        n++;
+        p += run;
+        bytes -= run;
+    }
+    return n;
+}
+
+// Fill in slot `tag` and ring its doorbell. Queued commands carry the sector
+// count in the features field and the tag in the count field.
+static int port_issue(struct ahci_disk* d, uint32_t tag, uint8_t cmd, uint32_t lba, uint32_t count,
+                      void* buf, uint32_t bytes, int write, int queued) {
+    struct cmd_header* h = &d->mem->list[tag];
+    struct cmd_table* t = &d->mem->tables[tag];
+
+    int prds = bytes ? build_prdt(t, buf, bytes) : 0;
+    if (prds < 0) return -1;
+
+    uint8_t* fis = t->cfis;
+    memset(fis, 0, 20);
+    fis[0] = FIS_TYPE_H2D;
+    fis[1] = FIS_H2D_COMMAND;
+    fis[2] = cmd;
+    fis[4] = (uint8_t)lba;
+    fis[5] = (uint8_t)(lba >> 8);
+    fis[6] = (uint8_t)(lba >> 16);
+    fis[7] = (cmd == ATA_CMD_IDENTIFY) ? 0 : FIS_DEV_LBA;
+    fis[8] = (uint8_t)(lba >> 24);
+    if (queued) {
+        fis[3] = (uint8_t)count;
+        fis[11] = (uint8_t)(count >> 8);
+        fis[12] = (uint8_t)(tag << 3);
+    } else {
+        fis[12] = (uint8_t)count;
+        fis[13] = (uint8_t)(count >> 8);
+    }
+
+    h->flags = (uint16_t)(HDR_CFL | (write ? HDR_WRITE : 0));
+    h->prdtl = (uint16_t)prds;
+    h->prdbc = 0;
+
+    d->busy |= 1u << tag;
+    if (queued) port_write(d, PX_SACT, 1u << tag);
+    port_write(d, PX_CI, 1u << tag);
+    ctr_inc(CTR_AHCI_COMMANDS);
+    return 0;
+}
+
+static void ahci_account(struct ahci_disk* d, uint32_t tag) {
+    if (d->req[tag].count == 0) return;     // IDENTIFY and FLUSH
+    ctr_add(d->req[tag].write ? CTR_AHCI_SECT_WRITE : CTR_AHCI_SECT_READ, d->req[tag].count);
+    trace_event(d->req[tag].write ? EV_AHCI_WRITE : EV_AHCI_READ, d->req[tag].lba,
+                (uint32_t)(rdtsc() - d->req[tag].start), ((uint32_t)d->index << 16) | d->req[tag].count);
+}
+
+// Retire the commands that have finished. A queued command is done once
+// its SActive bit drops (the drive's Set Device Bits FIS), the others when
+// their CI bit does.
+static int ahci_reap(struct ahci_disk* d) {
+    uint32_t is = port_read(d, PX_IS);
+    if (is & PXIS_FATAL) {
+        port_recover(d);
+        return -1;
+    }
+    if (is) port_write(d, PX_IS, is);
+
+    uint32_t active = port_read(d, PX_CI) | (d->ncq ? port_read(d, PX_SACT) : 0);
+    uint32_t done = d->busy & ~active;
+    while (done) {
+        uint32_t tag = (uint32_t)__builtin_ctz(done);
+        done &= done - 1;
+        d->busy &= ~(1u << tag);
+        ahci_account(d, tag);
+    }
+    return 0;
+}
+
+// Reap until none of `mask` is busy
+static int ahci_wait(struct ahci_disk* d, uint32_t mask) {
+    uint64_t end = deadline_ms(CMD_TIMEOUT_MS);
+    while (d->busy & mask) {
+        if (ahci_reap(d) < 0) return -1;
+        if (rdtsc() > end) {
+            port_recover(d);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int ahci_complete(struct blkdev* dev) {
+    struct ahci_disk* d = (struct ahci_disk*)dev->priv;
+    int r = ahci_wait(d, 0xFFFFFFFF);
+    if (d->failed) {
+        d->failed = 0;
+        r = -1;
+    }
+    return r;
+}
+
+// One non-queued command on slot 0, waited for. Queued and non-queued
+// commands must not be mixed, so the queue is drained first.
+static int ahci_command(struct ahci_disk* d, uint8_t cmd, void* buf, uint32_t bytes) {
+    if (ahci_complete(&d->dev) < 0) return -1;
+    d->req[0].count = 0;
+    if (port_issue(d, 0, cmd, 0, 0, buf, bytes, 0, 0) < 0) return -1;
+    return ahci_complete(&d->dev);
+}
+
+static int ahci_transfer(struct ahci_disk* d, int write, uint32_t lba, uint32_t count, void* buf);
+
+// DMA needs word-aligned buffers; an odd one is copied through `bounce`
+static int ahci_bounced(struct ahci_disk* d, int write, uint32_t lba, uint32_t count, void* buf) {
+    if (ahci_complete(&d->dev) < 0) return -1;
+    if (write) memcpy(bounce, buf, count * SECTOR_SIZE);
+    if (ahci_transfer(d, write, lba, count, bounce) < 0 || ahci_complete(&d->dev) < 0) return -1;
+    if (!write) memcpy(buf, bounce, count * SECTOR_SIZE);
+    return 0;
+}
+
+static int ahci_transfer(struct ahci_disk* d, int write, uint32_t lba, uint32_t count, void* buf) {
+    if ((uint32_t)buf & 1) return ahci_bounced(d, write, lba, count, buf);
+
+    // wait for a free tag
+    if ((d->busy & d->slots) == d->slots) {
+        ctr_inc(CTR_AHCI_QUEUE_FULL);
+        uint64_t end = deadline_ms(CMD_TIMEOUT_MS);
+        while ((d->busy & d->slots) == d->slots) {
+            if (ahci_reap(d) < 0) return -1;
+            if (rdtsc() > end) {
+                port_recover(d);
+                return -1;
+            }
+        }
+    }
+
+    uint32_t tag = (uint32_t)__builtin_ctz(~d->busy & d->slots);
+    d->req[tag].lba = lba;
+    d->req[tag].count = count;
+    d->req[tag].write = (uint8_t)write;
+    d->req[tag].start = rdtsc();
+
+    uint8_t cmd;
+    if (d->ncq) {
+        cmd = write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA;
+    } else {
+        cmd = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+    }
+    return port_issue(d, tag, cmd, lba, count, buf, count * SECTOR_SIZE, write, d->ncq);
+}
+
+// Returns as soon as the command is queued; with NCQ the next submits go
+// out while the drive works on this one. complete waits for all of them.
+static int ahci_submit(struct blkdev* dev, int write, uint32_t lba, uint32_t count, void* buf) {
+    struct ahci_disk* d = (struct ahci_disk*)dev->priv;
+    if (count == 0 || count > AHCI_MAX_XFER || lba + count > d->sectors || lba + count < lba) return -1;
+    return ahci_transfer(d, write, lba, count, buf);
+}
+
+// Large requests are split into AHCI_MAX_XFER pieces that are all queued
+// before waiting, so the drive sees up to its queue depth at once
+static int ahci_io(struct blkdev* dev, int write, uint32_t lba, uint32_t count, uint8_t* p) {
+    while (count > 0) {
+        uint32_t n = (count > AHCI_MAX_XFER) ? AHCI_MAX_XFER : count;
+        if (ahci_submit(dev, write, lba, n, p) < 0) {
+            ahci_complete(dev);
+            return -1;
+        }
+        lba += n;
+        count -= n;
+        p += n * SECTOR_SIZE;
+    }
+    return ahci_complete(dev);
+}
+
+static int ahci_read(struct blkdev* dev, uint32_t lba, uint32_t count, void* buf) {
+    return ahci_io(dev, 0, lba, count, (uint8_t*)buf);
+}
+
+static int ahci_write(struct blkdev* dev, uint32_t lba, uint32_t count, const void* buf) {
+    return ahci_io(dev, 1, lba, count, (uint8_t*)buf);
+}
+
+static int ahci_flush(struct blkdev* dev) {
+    return ahci_command((struct ahci_disk*)dev->priv, ATA_CMD_FLUSH_EXT, NULL, 0);
+}
+
+static uint32_t ahci_capacity(struct blkdev* dev) {
+    return ((struct ahci_disk*)dev->priv)->sectors;
+}
+
+static const struct blkdev_ops ahci_ops = {
+    .read     = ahci_read,
+    .write    = ahci_write,
+    .flush    = ahci_flush,
+    .capacity = ahci_capacity,
+    .submit   = ahci_submit,
+    .complete = ahci_complete,
+};
+
+uint32_t ahci_queue_depth(struct blkdev* dev) {
+    if (!dev || dev->ops != &ahci_ops) return 0;
+    struct ahci_disk* d = (struct ahci_disk*)dev->priv;
+    return d->depth;
+}
+
+static char* append(char* p, char* end, const char* s) {
+    while (*s && p < end - 1) *p++ = *s++;
+    *p = '\0';
+    return p;
+}
+
+static void ahci_describe(struct ahci_disk* d, const uint16_t* id, uint32_t depth) {
+    char model[41];
+
+    // the model string is stored as byte-swapped words
+    for (int i = 0; i < 20; ++i) {
+        model[2 * i] = (char)(id[27 + i] >> 8);
+        model[2 * i + 1] = (char)(id[27 + i] & 0xFF);
+    }
+    int end = 40;
+    while (end > 0 && model[end - 1] == ' ') end--;
+    model[end] = '\0';
+
+    char* p = append(d->info, d->info + sizeof(d->info), model);
+    if (d->ncq) {
+        char num[4] = { (char)('0' + depth / 10), (char)('0' + depth % 10), '\0', '\0' };
+        p = append(p, d->info + sizeof(d->info), ", NCQ ");
+        append(p, d->info + sizeof(d->info), depth >= 10 ? num : num + 1);
+    } else {
+        append(p, d->info + sizeof(d->info), ", no NCQ");
+    }
+}
+
+// IDENTIFY the drive on a started port and register it
+static int port_attach(struct ahci_disk* d, uint32_t cap) {
+    d->depth = 1;
+    d->slots = 1;
+    d->ncq = 0;
+    d->busy = 0;
+    if (ahci_command(d, ATA_CMD_IDENTIFY, identify_buf, sizeof(identify_buf)) < 0) return -1;
+
+    const uint16_t* id = identify_buf;
+    if (id[83] & (1u << 10)) {
+        // LBA48: the 64-bit count is cut to what a uint32_t LBA reaches
+        d->sectors = (id[102] || id[103]) ? 0xFFFFFFFF : ((uint32_t)id[100] | ((uint32_t)id[101] << 16));
+    } else {
+        d->sectors = (uint32_t)id[60] | ((uint32_t)id[61] << 16);
+    }
+    if (d->sectors == 0) return -1;
+
+    uint32_t depth = 1;
+    if ((cap & CAP_SNCQ) && (id[76] & (1u << 8))) {
+        d->ncq = 1;
+        depth = (id[75] & 0x1F) + 1u;
+        if (depth > CAP_NCS(cap)) depth = CAP_NCS(cap);
+    }
+    d->depth = depth;
+    d->slots = (depth == 32) ? 0xFFFFFFFF : (1u << depth) - 1;
+    ahci_describe(d, id, depth);
+
+    d->name[0] = 's';
+    d->name[1] = 'd';
+    d->name[2] = (char)('0' + disk_count);
+    d->name[3] = '\0';
+    d->dev.ops = &ahci_ops;
+    d->dev.name = d->name;
+    d->dev.info = d->info;
+    d->dev.priv = d;
+    return blkdev_register(&d->dev);
+}
+
+static int port_probe(uint8_t* hba, uint32_t cap, int port) {
+    struct ahci_disk* d = &disks[disk_count];
+    d->regs = hba + HBA_PORT(port);
+    d->mem = &port_mem[disk_count];
+    d->index = (uint8_t)disk_count;
+
+    if ((port_read(d, PX_SSTS) & 0xF) != SSTS_DET_PRESENT) return -1;
+    if (port_read(d, PX_SIG) != SIG_ATA) return -1;        // ATAPI, port multiplier...
+    if (port_stop(d) < 0) return -1;
+
+    memset(d->mem, 0, sizeof(*d->mem));
+    for (int s = 0; s < AHCI_SLOTS; ++s) {
+        d->mem->list[s].ctba = paging_phys(&d->mem->tables[s]);
+    }
+    port_write(d, PX_CLB, paging_phys(d->mem->list));
+    port_write(d, PX_CLBU, 0);
+    port_write(d, PX_FB, paging_phys(d->mem->fis));
+    port_write(d, PX_FBU, 0);
+    port_write(d, PX_SERR, 0xFFFFFFFF);
+    port_write(d, PX_IS, 0xFFFFFFFF);
+    port_write(d, PX_IE, 0);                                // polled
+    if (cap & CAP_SSS) port_write(d, PX_CMD, port_read(d, PX_CMD) | PXCMD_SUD);
+
+    // a port left running would keep writing FISes into port_mem, which
+    // the next port probed reuses
+    if (port_start(d) < 0 || port_attach(d, cap) < 0) {
+        port_stop(d);
+        return -1;
+    }
+
+    disk_count++;
+    return 0;
+}
+
+// With BIOS/OS handoff the firmware may still own the HBA: ask for it
+static void hba_take_ownership(uint8_t* hba) {
+    if (!(hba_read(hba, HBA_CAP2) & CAP2_BOH)) return;
+
+    hba_write(hba, HBA_BOHC, hba_read(hba, HBA_BOHC) | BOHC_OOS);
+    uint64_t end = deadline_ms(2000);
+    while ((hba_read(hba, HBA_BOHC) & BOHC_BOS) && rdtsc() < end) {
+        __asm__ __volatile__ ("pause");
+    }
+}
+
+void ahci_init(void) {
+    struct pci_dev hbas[AHCI_MAX_HBAS];
+    int n = pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA, PCI_PROGIF_AHCI, hbas, AHCI_MAX_HBAS);
+
+    for (int i = 0; i < n; ++i) {
+        uint32_t abar = pci_bar_mem(&hbas[i], AHCI_ABAR);
+        if (abar == 0) continue;
+
+        pci_enable(&hbas[i]);
+        paging_map_mmio(abar, AHCI_ABAR_SIZE);
+        uint8_t* hba = (uint8_t*)abar;
+
+        hba_take_ownership(hba);
+        hba_write(hba, HBA_GHC, hba_read(hba, HBA_GHC) | GHC_AE);
+
+        uint32_t cap = hba_read(hba, HBA_CAP);
+        uint32_t pi = hba_read(hba, HBA_PI);
+        for (int port = 0; port < 32 && disk_count < AHCI_MAX_DISKS; ++port) {
+            if (pi & (1u << port)) port_probe(hba, cap, port);
+        }
+    }
+}
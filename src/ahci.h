@@ -0,0 +1,23 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+#include "blkdev.h"
+
+#define AHCI_MAX_HBAS    2
+#define AHCI_MAX_DISKS   4
+#define AHCI_SLOTS       32         // command slots, and NCQ tags, per port
+#define AHCI_MAX_XFER    256        // sectors per command (128 KiB)
+#define AHCI_PRDS        (AHCI_MAX_XFER / 8 + 1)   // one per 4 KiB page, plus a partial one
+
+// Find AHCI controllers on the PCI bus and register each SATA disk behind
+// them as "sd0".."sd3". Disks that support native command queuing take up
+// to 32 READ/WRITE FPDMA QUEUED commands at once through submit; the others
+// get one READ/WRITE DMA EXT at a time.
+void ahci_init(void);
+
+// Commands `dev` accepts before one has to finish: its NCQ depth, 1 without
+// NCQ, 0 if it is not an AHCI disk
+uint32_t ahci_queue_depth(struct blkdev* dev);
+
+#endif
@@ -1,56 +1,291 @@
 #include "io.h"
 #include "ata.h"
+#include "blkdev.h"
+#include "trace.h"
 #include <stdint.h>
+#include <stddef.h>
 
-static void ata_wait_busy(void) {
-    while (inb(ATA_REG_STATUS) & ATA_STATUS_BSY) {
-        // spin
+#define IDENTIFY_TIMEOUT_MS  100
+
+struct ata_drive;
+
+// Master and slave share a channel's task file, so a channel runs one command at a time
+struct ata_channel {
+    uint16_t io;
+    uint16_t ctrl;
+    int selected;                   // drive select byte last written, -1 if unknown
+    struct ata_drive* pending;      // drive with a split-phase command outstanding
+};
+
+struct ata_drive {
+    struct blkdev dev;
+    struct ata_channel* chan;
+    uint8_t  index;
+    uint8_t  slave;
+    uint8_t  present;
+    uint32_t sectors;
+    char     name[5];
+    char     model[41];
+
+    // outstanding split-phase request
+    int      write;
+    uint32_t lba;
+    uint32_t count;
+    uint8_t* buf;
+    uint64_t start;
+};
+
+static struct ata_channel ata_channels[2] = {
+    { ATA_PRIMARY_IO,   ATA_PRIMARY_CTRL,   -1, NULL },
+    { ATA_SECONDARY_IO, ATA_SECONDARY_CTRL, -1, NULL },
+};
+
+static struct ata_drive ata_drives[ATA_DRIVES];
+
+static int ata_wait_busy(struct ata_channel* ch) {
+    uint64_t start = rdtsc();
+    uint32_t spins = 0;
+    uint8_t st;
+
+    while ((st = inb(ch->io + ATA_REG_STATUS)) & ATA_STATUS_BSY) {
+        spins++;
     }
+
+    ctr_inc(CTR_ATA_BUSY_WAITS);
+    ctr_add(CTR_ATA_BUSY_SPINS, spins);
+    ctr_add(CTR_ATA_BUSY_CYCLES, rdtsc() - start);
+    return (st & (ATA_STATUS_ERR | ATA_STATUS_DF)) ? -1 : 0;
 }
 
-static void ata_wait_drq(void) {
+static int ata_wait_drq(struct ata_channel* ch) {
     uint8_t st;
+    uint32_t spins = 0;
     do {
-        st = inb(ATA_REG_STATUS);
+        st = inb(ch->io + ATA_REG_STATUS);
+        spins++;
+        if (!(st & ATA_STATUS_BSY) && (st & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+            ctr_add(CTR_ATA_DRQ_SPINS, spins);
+            return -1;
+        }
     } while ((st & ATA_STATUS_BSY) || !(st & ATA_STATUS_DRQ));
+
+    ctr_add(CTR_ATA_DRQ_SPINS, spins);
+    return 0;
 }
 
-void ata_read_sector(uint32_t lba, void* buffer) {
-    uint16_t* buf = (uint16_t*)buffer;
+static void ata_select(struct ata_drive* d, uint32_t lba) {
+    struct ata_channel* ch = d->chan;
+    int sel = 0xE0 | (d->slave << 4) | ((lba >> 24) & 0x0F);   // LBA mode
 
-    ata_wait_busy();
+    outb(ch->io + ATA_REG_HDDEVSEL, (uint8_t)sel);
+    if (ch->selected < 0 || (sel & 0xF0) != (ch->selected & 0xF0)) {
+        // the drive needs ~400ns to present its status after a switch
+        for (int i = 0; i < 4; ++i) inb(ch->ctrl);
+    }
+    ch->selected = sel;
+}
 
-    outb(ATA_REG_HDDEVSEL, 0xE0 | ((lba >> 24) & 0x0F)); // master, LBA
-    outb(ATA_REG_SECCOUNT0, 1);                          // 1 sector
-    outb(ATA_REG_LBA0, (uint8_t)(lba & 0xFF));
-    outb(ATA_REG_LBA1, (uint8_t)((lba >> 8) & 0xFF));
-    outb(ATA_REG_LBA2, (uint8_t)((lba >> 16) & 0xFF));
-    outb(ATA_REG_COMMAND, ATA_CMD_READ_SECT);
+static int ata_issue(struct ata_drive* d, uint8_t cmd, uint32_t lba, uint32_t count) {
+    struct ata_channel* ch = d->chan;
 
-    ata_wait_drq();
+    // a stale ERR from the previous command is cleared by issuing the next one
+    ata_wait_busy(ch);
+    ata_select(d, lba);
+    outb(ch->io + ATA_REG_SECCOUNT0, (uint8_t)(count & 0xFF));  // 256 is sent as 0
+    outb(ch->io + ATA_REG_LBA0, (uint8_t)(lba & 0xFF));
+    outb(ch->io + ATA_REG_LBA1, (uint8_t)((lba >> 8) & 0xFF));
+    outb(ch->io + ATA_REG_LBA2, (uint8_t)((lba >> 16) & 0xFF));
+    outb(ch->io + ATA_REG_COMMAND, cmd);
+    return 0;
+}
 
-    for (int i = 0; i < SECTOR_SIZE / 2; ++i) {
-        buf[i] = inw(ATA_REG_DATA);   // read 16 bits at a time, as ATA expects
+static int ata_pio_in(struct ata_drive* d, uint8_t* buf, uint32_t count) {
+    for (uint32_t s = 0; s < count; ++s) {
+        if (ata_wait_drq(d->chan) < 0) return -1;
+        insw(d->chan->io + ATA_REG_DATA, buf + s * SECTOR_SIZE, SECTOR_SIZE / 2);
     }
+    return 0;
 }
 
-void ata_write_sector(uint32_t lba, const void* buffer) {
-    const uint16_t* buf = (const uint16_t*)buffer;
+static int ata_pio_out(struct ata_drive* d, const uint8_t* buf, uint32_t count) {
+    for (uint32_t s = 0; s < count; ++s) {
+        if (ata_wait_drq(d->chan) < 0) return -1;
+        outsw(d->chan->io + ATA_REG_DATA, buf + s * SECTOR_SIZE, SECTOR_SIZE / 2);
+    }
+    return 0;
+}
 
-    ata_wait_busy();
+static void ata_account(struct ata_drive* d, int write, uint32_t lba, uint32_t count, uint64_t start) {
+    ctr_add(write ? CTR_ATA_SECT_WRITE : CTR_ATA_SECT_READ, count);
+    trace_event(write ? EV_ATA_WRITE : EV_ATA_READ, lba, (uint32_t)(rdtsc() - start),
+                ((uint32_t)d->index << 16) | count);
+}
 
-    outb(ATA_REG_HDDEVSEL, 0xE0 | ((lba >> 24) & 0x0F));
-    outb(ATA_REG_SECCOUNT0, 1);
-    outb(ATA_REG_LBA0, (uint8_t)(lba & 0xFF));
-    outb(ATA_REG_LBA1, (uint8_t)((lba >> 8) & 0xFF));
-    outb(ATA_REG_LBA2, (uint8_t)((lba >> 16) & 0xFF));
-    outb(ATA_REG_COMMAND, ATA_CMD_WRITE_SECT);
+static int ata_complete(struct blkdev* dev) {
+    struct ata_drive* d = (struct ata_drive*)dev->priv;
+    struct ata_channel* ch = d->chan;
+    int r;
 
-    ata_wait_drq();
+    if (ch->pending != d) return 0;
+    ch->pending = NULL;
 
-    for (int i = 0; i < SECTOR_SIZE / 2; ++i) {
-        outw(ATA_REG_DATA, buf[i]);  // write 16 bits at a time
+    if (d->write) {
+        r = ata_wait_busy(ch);
+    } else {
+        r = ata_pio_in(d, d->buf, d->count);
     }
+    ata_account(d, d->write, d->lba, d->count, d->start);
+    return r;
+}
+
+// Reads only issue the command: the drive fetches the data while the caller
+// goes on to start other disks, and ata_complete moves it later. Writes have
+// to push their data now, but the wait for the drive to commit is deferred.
+static int ata_submit(struct blkdev* dev, int write, uint32_t lba, uint32_t count, void* buf) {
+    struct ata_drive* d = (struct ata_drive*)dev->priv;
+    struct ata_channel* ch = d->chan;
+
+    if (ch->pending && ata_complete(&ch->pending->dev) < 0) return -1;
+    if (count == 0 || count > ATA_MAX_XFER) return -1;
+
+    d->write = write;
+    d->lba = lba;
+    d->count = count;
+    d->buf = (uint8_t*)buf;
+    d->start = rdtsc();
+
+    ata_issue(d, write ? ATA_CMD_WRITE_SECT : ATA_CMD_READ_SECT, lba, count);
+    if (write && ata_pio_out(d, d->buf, count) < 0) return -1;
+
+    ch->pending = d;
+    return 0;
+}
+
+static int ata_read(struct blkdev* dev, uint32_t lba, uint32_t count, void* buf) {
+    uint8_t* p = (uint8_t*)buf;
+    while (count > 0) {
+        uint32_t n = (count > ATA_MAX_XFER) ? ATA_MAX_XFER : count;
+        if (ata_submit(dev, 0, lba, n, p) < 0 || ata_complete(dev) < 0) return -1;
+        lba += n;
+        count -= n;
+        p += n * SECTOR_SIZE;
+    }
+    return 0;
+}
+
+static int ata_write(struct blkdev* dev, uint32_t lba, uint32_t count, const void* buf) {
+    const uint8_t* p = (const uint8_t*)buf;
+    while (count > 0) {
+        uint32_t n = (count > ATA_MAX_XFER) ? ATA_MAX_XFER : count;
+        if (ata_submit(dev, 1, lba, n, (void*)p) < 0 || ata_complete(dev) < 0) return -1;
+        lba += n;
+        count -= n;
+        p += n * SECTOR_SIZE;
+    }
+    return 0;
+}
+
+static int ata_flush(struct blkdev* dev) {
+    struct ata_drive* d = (struct ata_drive*)dev->priv;
 
-    ata_wait_busy();
-}
\ No newline at end of file
+    if (d->chan->pending && ata_complete(&d->chan->pending->dev) < 0) return -1;
+    ata_issue(d, ATA_CMD_FLUSH, 0, 0);
+    return ata_wait_busy(d->chan);
+}
+
+static uint32_t ata_capacity(struct blkdev* dev) {
+    return ((struct ata_drive*)dev->priv)->sectors;
+}
+
+static const struct blkdev_ops ata_ops = {
+    .read     = ata_read,
+    .write    = ata_write,
+    .flush    = ata_flush,
+    .capacity = ata_capacity,
+    .submit   = ata_submit,
+    .complete = ata_complete,
+};
+
+// Poll the status register until (status & mask) == want, giving up after the timeout
+static int ata_poll(struct ata_channel* ch, uint8_t mask, uint8_t want, uint8_t* st) {
+    uint64_t deadline = rdtsc() + div_u64_u32(tsc_hz, 1000, 0) * IDENTIFY_TIMEOUT_MS;
+    do {
+        *st = inb(ch->io + ATA_REG_STATUS);
+        if ((*st & mask) == want) return 0;
+    } while (rdtsc() < deadline);
+    return -1;
+}
+
+static int ata_identify(struct ata_drive* d) {
+    struct ata_channel* ch = d->chan;
+    uint16_t id[256];
+    uint8_t st;
+
+    if (inb(ch->io + ATA_REG_STATUS) == 0xFF) return -1;   // floating bus: nothing attached
+
+    outb(ch->io + ATA_REG_HDDEVSEL, (uint8_t)(0xA0 | (d->slave << 4)));
+    for (int i = 0; i < 4; ++i) inb(ch->ctrl);
+    ch->selected = -1;
+
+    outb(ch->io + ATA_REG_SECCOUNT0, 0);
+    outb(ch->io + ATA_REG_LBA0, 0);
+    outb(ch->io + ATA_REG_LBA1, 0);
+    outb(ch->io + ATA_REG_LBA2, 0);
+    outb(ch->io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+    if (inb(ch->io + ATA_REG_STATUS) == 0) return -1;       // no drive in this position
+    if (ata_poll(ch, ATA_STATUS_BSY, 0, &st) < 0) return -1;
+
+    // ATAPI and SATA bridges set a signature here and abort IDENTIFY
+    if (inb(ch->io + ATA_REG_LBA1) || inb(ch->io + ATA_REG_LBA2)) return -1;
+
+    if (ata_poll(ch, ATA_STATUS_DRQ | ATA_STATUS_ERR, ATA_STATUS_DRQ, &st) < 0) return -1;
+    insw(ch->io + ATA_REG_DATA, id, 256);
+
+    d->sectors = (uint32_t)id[60] | ((uint32_t)id[61] << 16);   // LBA28 sector count
+
+    // the model string is stored as byte-swapped words
+    for (int i = 0; i < 20; ++i) {
+        d->model[2 * i] = (char)(id[27 + i] >> 8);
+        d->model[2 * i + 1] = (char)(id[27 + i] & 0xFF);
+    }
+    int end = 40;
+    while (end > 0 && d->model[end - 1] == ' ') end--;
+    d->model[end] = '\0';
+
+    return d->sectors ? 0 : -1;
+}
+
+void ata_init(void) {
+    for (int i = 0; i < ATA_DRIVES; ++i) {
+        struct ata_drive* d = &ata_drives[i];
+
+        d->index = (uint8_t)i;
+        d->chan = &ata_channels[i / 2];
+        d->slave = (uint8_t)(i & 1);
+        d->name[0] = 'a';
+        d->name[1] = 't';
+        d->name[2] = 'a';
+        d->name[3] = (char)('0' + i);
+        d->name[4] = '\0';
+
+        if (ata_identify(d) < 0) continue;
+
+        d->present = 1;
+        d->dev.ops = &ata_ops;
+        d->dev.name = d->name;
+        d->dev.info = d->model;
+        d->dev.priv = d;
+        blkdev_register(&d->dev);
+    }
+}
+
+int ata_read_sector(uint32_t lba, void* buffer) {
+    if (!ata_drives[0].present) return -1;
+    return ata_read(&ata_drives[0].dev, lba, 1, buffer);
+}
+
+int ata_write_sector(uint32_t lba, const void* buffer) {
+    if (!ata_drives[0].present) return -1;
+    return ata_write(&ata_drives[0].dev, lba, 1, buffer);
+}
@@ -2,9 +2,12 @@
 #define ATA_H
 
 #include <stdint.h>
+#include "blkdev.h"
 
 #define SECTOR_SIZE      512
 #define DISK_TOTAL_SECT  (64 * 1024 * 1024 / SECTOR_SIZE)   // 131072
+
+// Original flat filesystem layout; fs.c still reads it to migrate old images
 #define DIR_SECTORS      16
 #define DIR_START_LBA    1
 #define DATA_START_LBA   (DIR_START_LBA + DIR_SECTORS)      // 17
@@ -13,28 +16,44 @@
 
 #define ATA_PRIMARY_IO      0x1F0
 #define ATA_PRIMARY_CTRL    0x3F6
-
-#define ATA_REG_DATA        (ATA_PRIMARY_IO + 0)
-#define ATA_REG_ERROR       (ATA_PRIMARY_IO + 1)
-#define ATA_REG_SECCOUNT0   (ATA_PRIMARY_IO + 2)
-#define ATA_REG_LBA0        (ATA_PRIMARY_IO + 3)
-#define ATA_REG_LBA1        (ATA_PRIMARY_IO + 4)
-#define ATA_REG_LBA2        (ATA_PRIMARY_IO + 5)
-#define ATA_REG_HDDEVSEL    (ATA_PRIMARY_IO + 6)
-#define ATA_REG_COMMAND     (ATA_PRIMARY_IO + 7)
-#define ATA_REG_STATUS      (ATA_PRIMARY_IO + 7)
+#define ATA_SECONDARY_IO    0x170
+#define ATA_SECONDARY_CTRL  0x376
+
+// Register offsets from a channel's I/O base
+#define ATA_REG_DATA        0
+#define ATA_REG_ERROR       1
+#define ATA_REG_SECCOUNT0   2
+#define ATA_REG_LBA0        3
+#define ATA_REG_LBA1        4
+#define ATA_REG_LBA2        5
+#define ATA_REG_HDDEVSEL    6
+#define ATA_REG_COMMAND     7
+#define ATA_REG_STATUS      7
 
 #define ATA_CMD_READ_SECT   0x20
 #define ATA_CMD_WRITE_SECT  0x30
+#define ATA_CMD_FLUSH       0xE7
+#define ATA_CMD_IDENTIFY    0xEC
 
 #define ATA_STATUS_BSY      0x80
 #define ATA_STATUS_DRDY     0x40
+#define ATA_STATUS_DF       0x20
 #define ATA_STATUS_DRQ      0x08
+#define ATA_STATUS_ERR      0x01
+
+#define ATA_MAX_XFER        256     // sectors per READ/WRITE SECTORS command
+#define ATA_DRIVES          4       // primary/secondary x master/slave
 
+// Probe all four IDE positions and register the ATA disks found as
+// "ata0".."ata3" (primary master, primary slave, secondary master, secondary slave).
+void ata_init(void);
 
-void ata_read_sector(uint32_t lba, void* buffer);
+// Single-sector access to the primary master, kept for quick tests and as the
+// baseline other drivers are benchmarked against. Return 0, or -1 on an error
+// or when there is no primary master.
+int ata_read_sector(uint32_t lba, void* buffer);
 
-void ata_write_sector(uint32_t lba, const void* buffer);
+int ata_write_sector(uint32_t lba, const void* buffer);
 
 
-#endif
\ No newline at end of file
+#endif
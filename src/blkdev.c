@@ -0,0 +1,39 @@
+#include "blkdev.h"
+#include "serial.h"
+#include <stdint.h>
+#include <stddef.h>
+
+static struct blkdev* devices[BLKDEV_MAX];
+static int device_count;
+
+int blkdev_register(struct blkdev* dev) {
+    if (device_count >= BLKDEV_MAX) {
+        serial_puts("blkdev: table full, dropping ");
+        serial_puts(dev->name);
+        serial_puts("\n");
+        return -1;
+    }
+    devices[device_count++] = dev;
+    return 0;
+}
+
+struct blkdev* blkdev_find(const char* name) {
+    for (int i = 0; i < device_count; ++i) {
+        const char* a = devices[i]->name;
+        const char* b = name;
+        while (*a && *a == *b) {
+            a++;
+            b++;
+        }
+        if (*a == '\0' && *b == '\0') return devices[i];
+    }
+    return NULL;
+}
+
+int blkdev_count(void) {
+    return device_count;
+}
+
+struct blkdev* blkdev_get(int index) {
+    return (index >= 0 && index < device_count) ? devices[index] : NULL;
+}
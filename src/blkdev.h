@@ -0,0 +1,58 @@
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include <stdint.h>
+
+// ata0-3, sd0-3, ram0 and md0-1 can all exist at once; the rest is headroom
+#define BLKDEV_MAX  16
+
+struct blkdev;
+
+// Sector-addressed block device. read/write/flush return 0 or -1.
+struct blkdev_ops {
+    int      (*read)(struct blkdev* dev, uint32_t lba, uint32_t count, void* buf);
+    int      (*write)(struct blkdev* dev, uint32_t lba, uint32_t count, const void* buf);
+    int      (*flush)(struct blkdev* dev);
+    uint32_t (*capacity)(struct blkdev* dev);
+
+    // Optional split-phase I/O: submit starts a transfer and returns early,
+    // complete finishes everything the device has outstanding. A striped
+    // device uses these to keep several disks busy at once; a queued disk
+    // (AHCI with NCQ) takes several submits before it has to wait. Either
+    // may be NULL.
+    int      (*submit)(struct blkdev* dev, int write, uint32_t lba, uint32_t count, void* buf);
+    int      (*complete)(struct blkdev* dev);
+};
+
+struct blkdev {
+    const struct blkdev_ops* ops;
+    const char* name;
+    const char* info;       // model or description for lsblk
+    void* priv;
+};
+
+static inline int blk_read(struct blkdev* dev, uint32_t lba, uint32_t count, void* buf) {
+    return dev->ops->read(dev, lba, count, buf);
+}
+
+static inline int blk_write(struct blkdev* dev, uint32_t lba, uint32_t count, const void* buf) {
+    return dev->ops->write(dev, lba, count, buf);
+}
+
+static inline int blk_flush(struct blkdev* dev) {
+    return dev->ops->flush ? dev->ops->flush(dev) : 0;
+}
+
+static inline uint32_t blk_capacity(struct blkdev* dev) {
+    return dev->ops->capacity(dev);
+}
+
+int blkdev_register(struct blkdev* dev);
+
+struct blkdev* blkdev_find(const char* name);
+
+int blkdev_count(void);
+
+struct blkdev* blkdev_get(int index);
+
+#endif
@@ -0,0 +1,97 @@
+#include "crc32c.h"
+#include "trace.h"
+#include <stdint.h>
+
+#define CRC32C_POLY   0x82F63B78u     // reflected Castagnoli polynomial
+
+static uint32_t crc_table[8][256];
+static int use_sse42;
+
+static inline uint32_t load32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Eight table lookups per 8 input bytes instead of eight dependent ones
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t* p, uint32_t len) {
+    while (len && ((uint32_t)p & 7)) {
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+
+    while (len >= 8) {
+        uint32_t one = load32(p) ^ crc;
+        uint32_t two = load32(p + 4);
+        crc = crc_table[7][one & 0xFF] ^
+              crc_table[6][(one >> 8) & 0xFF] ^
+              crc_table[5][(one >> 16) & 0xFF] ^
+              crc_table[4][one >> 24] ^
+              crc_table[3][two & 0xFF] ^
+              crc_table[2][(two >> 8) & 0xFF] ^
+              crc_table[1][(two >> 16) & 0xFF] ^
+              crc_table[0][two >> 24];
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t* p, uint32_t len) {
+    while (len && ((uint32_t)p & 3)) {
+        __asm__ ("crc32b %1, %0" : "+r"(crc) : "rm"(*p));
+        p++;
+        len--;
+    }
+
+    while (len >= 4) {
+        uint32_t v = *(const uint32_t*)p;
+        __asm__ ("crc32l %1, %0" : "+r"(crc) : "rm"(v));
+        p += 4;
+        len -= 4;
+    }
+
+    while (len--) {
+        __asm__ ("crc32b %1, %0" : "+r"(crc) : "rm"(*p));
+        p++;
+    }
+    return crc;
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, uint32_t len) {
+    uint64_t start = rdtsc();
+    const uint8_t* p = (const uint8_t*)data;
+
+    crc = ~crc;
+    crc = use_sse42 ? crc32c_hw(crc, p, len) : crc32c_sw(crc, p, len);
+
+    ctr_add(CTR_CRC_BYTES, len);
+    ctr_add(CTR_CRC_CYCLES, rdtsc() - start);
+    return ~crc;
+}
+
+void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int t = 1; t < 8; ++t) {
+            uint32_t prev = crc_table[t - 1][i];
+            crc_table[t][i] = crc_table[0][prev & 0xFF] ^ (prev >> 8);
+        }
+    }
+
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ __volatile__ ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    use_sse42 = (ecx >> 20) & 1;
+}
+
+const char* crc32c_impl(void) {
+    return use_sse42 ? "sse4.2" : "slicing-by-8";
+}
@@ -0,0 +1,17 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+
+// CRC-32C (Castagnoli), zlib-style: start with 0 and feed the previous
+// result back in to checksum data that arrives in pieces.
+uint32_t crc32c(uint32_t crc, const void* data, uint32_t len);
+
+// Builds the slicing-by-8 tables and picks the SSE4.2 crc32 instruction
+// when CPUID reports it. Must run before the first crc32c() call.
+void crc32c_init(void);
+
+// "sse4.2" or "slicing-by-8"
+const char* crc32c_impl(void);
+
+#endif
@@ -1,173 +1,1362 @@
 #include "ata.h"
+#include "blkdev.h"
 #include "fs.h"
+#include "trace.h"
+#include "kstring.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "spinlock.h"
 #include <stdint.h>
 #include <stddef.h>
 
-struct dir_entry root_dir[MAX_FILES];
+/*
+ * On-disk layout
+ *
+ *   LBA 0                      superblock
+ *   LBA bitmap_lba ..          allocation bitmap, one bit per sector, at the
+ *                              end of the disk
+ *   everything else            B-tree nodes and file data, handed out by the
+ *                              bitmap
+ *
+ * Every directory is a B+tree of one-sector nodes keyed by name. Leaves hold
+ * the dir_entry records and are linked left to right for listing; interior
+ * nodes hold separator names and child LBAs. A directory is identified by its
+ * root node, which never moves: when the root splits its contents move to a
+ * new node and the root becomes their parent. Deleting never merges nodes, so
+ * the height only follows the largest size the directory has ever had.
+ *
+ * Mounting reads the superblock and the bitmap, nothing that grows with the
+ * number of files. Lookups read one node per level, and the upper levels stay
+ * in a small node cache.
+ *
+ * File data may be stored as one LZ block (DE_COMPRESSED) when that saves at
+ * least a sector. Reads of such files pull the compressed sectors and expand
+ * them into a one-file cache that later preads are served from.
+ *
+ * Each file records a CRC-32C of its bytes as stored, computed while the
+ * sectors are written and checked whenever the file is read in full.
+ *
+ * Files of up to FS_INLINE_MAX bytes (DE_INLINE) have no extent at all: the
+ * data sits in the directory record, so reading one costs only the lookup
+ * and writing one rewrites just its leaf.
+ *
+ * All I/O goes through the mounted block device, so the same layout works on
+ * a single disk or a striped array; file extents move as one multi-sector
+ * request.
+ */
 
-static void fs_load_directory(void) {
-    uint8_t sector[SECTOR_SIZE];
-    uint8_t* p = (uint8_t*)root_dir;
-    size_t to_read = sizeof(root_dir);  // 8192 bytes
+#define FS_MAGIC          0x32534654      // "TFS2"
+#define FS_VERSION        1
+#define FS_MAX_SECTORS    (1u << 20)      // 512 MiB; larger devices use only this much
+#define FS_MIN_SECTORS    64
+#define FS_IO_BATCH       32              // sectors written per checksum pass
+#define BITS_PER_SECTOR   (SECTOR_SIZE * 8)
+
+#define BT_MAGIC          0x5442          // "BT"
+#define BT_LEAF_MAX       7
+#define BT_KEYS_MAX       17
+#define NODE_CACHE_SIZE   32
+
+struct fs_super {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_sectors;
+    uint32_t bitmap_lba;
+    uint32_t bitmap_sectors;
+    uint32_t root_lba;
+    uint8_t  _pad[SECTOR_SIZE - 24];
+} __attribute__((packed));
+
+struct bt_node {
+    uint16_t magic;
+    uint8_t  leaf;
+    uint8_t  _pad;
+    uint16_t count;                 // records in a leaf, keys in an interior node
+    uint16_t _pad2;
+    uint32_t next;                  // next leaf to the right, 0 for the last
+    uint32_t _reserved;
+    union {
+        struct dir_entry rec[BT_LEAF_MAX];
+        struct {
+            uint32_t child[BT_KEYS_MAX + 1];
+            char     key[BT_KEYS_MAX][FS_NAME_MAX];
+        } in;
+        uint8_t _raw[SECTOR_SIZE - 16];
+    };
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct dir_entry) == 64, "dir_entry must stay 64 bytes");
+_Static_assert(sizeof(struct bt_node) == SECTOR_SIZE, "bt_node must fill one sector");
+_Static_assert(sizeof(struct fs_super) == SECTOR_SIZE, "fs_super must fill one sector");
+
+// Every public call runs under fs_lock: the bitmap, node cache, compression
+// buffers and the block device behind them are all shared between CPUs.
+// The *_locked functions expect it held and never take it themselves.
+static struct spinlock fs_lock = SPINLOCK_INIT;
+
+static struct blkdev* fs_dev;
+static struct fs_super sb;
+static uint32_t fs_bitmap[FS_MAX_SECTORS / 32];
+static uint8_t  bitmap_dirty[FS_MAX_SECTORS / BITS_PER_SECTOR];
+static uint32_t alloc_hint;
+static uint32_t free_sectors;
+
+static char cwd[FS_PATH_MAX] = "/";
+
+static struct {
+    uint32_t lba;                   // 0 = empty slot (LBA 0 is never a node)
+    uint32_t stamp;
+    struct bt_node node;
+} node_cache[NODE_CACHE_SIZE];
+static uint32_t node_clock;
+
+static struct lz_state lz;
+static uint8_t  zbuf[FS_MAX_FILE_SIZE];         // compressed data on its way to or from disk
+static uint8_t  zcache[FS_MAX_FILE_SIZE];       // expanded contents of one compressed file
+static uint32_t zcache_lba;                     // extent it came from, 0 if none
+
+// ===== Allocation bitmap =====
 
-    for (uint32_t i = 0; i < DIR_SECTORS; ++i) {
-        ata_read_sector(DIR_START_LBA + i, sector);
-        size_t chunk = (to_read > SECTOR_SIZE) ? SECTOR_SIZE : to_read;
-        for (size_t j = 0; j < chunk; ++j) {
-            p[i * SECTOR_SIZE + j] = sector[j];
+static int bit_test(uint32_t lba) {
+    return (fs_bitmap[lba >> 5] >> (lba & 31)) & 1;
+}
+
+static void bits_assign(uint32_t lba, uint32_t count, int used) {
+    for (uint32_t i = lba; i < lba + count; ++i) {
+        if (used) {
+            fs_bitmap[i >> 5] |= 1u << (i & 31);
+        } else {
+            fs_bitmap[i >> 5] &= ~(1u << (i & 31));
         }
-        to_read -= chunk;
-        if (to_read == 0) break;
+        bitmap_dirty[i / BITS_PER_SECTOR] = 1;
     }
-
 }
 
-static void fs_save_directory(void) {
-    uint8_t sector[SECTOR_SIZE];
-    uint8_t* p = (uint8_t*)root_dir;
-    size_t remaining = sizeof(root_dir);
+// Next-fit search for `count` contiguous free sectors; returns the first LBA or 0
+static uint32_t fs_alloc(uint32_t count) {
+    uint32_t total = sb.total_sectors;
+    uint32_t pos = alloc_hint;
+    uint32_t start = 0, run = 0;
 
-    for (uint32_t i = 0; i < DIR_SECTORS; ++i) {
-        size_t chunk = (remaining > SECTOR_SIZE) ? SECTOR_SIZE : remaining;
-        for (size_t j = 0; j < chunk; ++j) {
-            sector[j] = p[i * SECTOR_SIZE + j];
+    if (count == 0 || count > free_sectors) return 0;
+
+    for (uint32_t scanned = 0; scanned < total + count; ) {
+        if (pos >= total) {
+            pos = 0;            // extents never wrap around the end
+            run = 0;
         }
-        for (size_t j = chunk; j < SECTOR_SIZE; ++j) {
-            sector[j] = 0;
+        if ((pos & 31) == 0 && fs_bitmap[pos >> 5] == 0xFFFFFFFF) {
+            pos += 32;          // skip full words
+            scanned += 32;
+            run = 0;
+            continue;
         }
-        ata_write_sector(DIR_START_LBA + i, sector);
-        remaining -= chunk;
-        if (remaining == 0) break;
+        if (bit_test(pos)) {
+            run = 0;
+        } else {
+            if (run == 0) start = pos;
+            if (++run == count) {
+                bits_assign(start, count, 1);
+                free_sectors -= count;
+                alloc_hint = start + count;
+                return start;
+            }
+        }
+        pos++;
+        scanned++;
     }
+    return 0;
 }
-static int fs_find_free_slot(void) {
-    for (int i = 0; i < MAX_FILES; ++i) {
-        if (!root_dir[i].used) {
-            return i;
-        }
+
+static void fs_free(uint32_t lba, uint32_t count) {
+    if (count == 0) return;
+    if (zcache_lba >= lba && zcache_lba < lba + count) {
+        zcache_lba = 0;
     }
-    return -1;
+    bits_assign(lba, count, 0);
+    free_sectors += count;
 }
 
-static int fs_find_by_name(const char* name) {
-    for (int i = 0; i < MAX_FILES; ++i) {
-        if (root_dir[i].used) {
-            // simple strcmp
-            const char* a = root_dir[i].name;
-            const char* b = name;
-            int eq = 1;
-            for (int j = 0; j < 24; ++j) {
-                if (a[j] != b[j]) {
-                    eq = 0;
-                    break;
-                }
-                if (a[j] == '\0') break;
+// Write the dirty bitmap sectors back; a sector that fails stays dirty
+static int fs_flush(void) {
+    const uint8_t* p = (const uint8_t*)fs_bitmap;
+    int r = 0;
+    for (uint32_t i = 0; i < sb.bitmap_sectors; ++i) {
+        if (bitmap_dirty[i]) {
+            if (blk_write(fs_dev, sb.bitmap_lba + i, 1, p + i * SECTOR_SIZE) < 0) {
+                r = FS_EIO;
+                continue;
             }
-            if (eq) return i;
+            bitmap_dirty[i] = 0;
         }
     }
-    return -1;
+    return r;
 }
 
-static uint32_t fs_slot_lba(int slot) {
-    return DATA_START_LBA + (uint32_t)slot * FILE_SECTORS;
+// ===== Node cache =====
+
+// A node fresh from disk must look like one before its count is trusted
+static int node_valid(const struct bt_node* n) {
+    if (n->magic != BT_MAGIC || n->leaf > 1) return 0;
+    return n->count <= (n->leaf ? BT_LEAF_MAX : BT_KEYS_MAX);
 }
 
-int fs_write_file(const char* name, const uint8_t* data, uint32_t size) {
-    if (size > 64 * 1024) size = 64 * 1024;
+static int node_read(uint32_t lba, struct bt_node* out) {
+    int victim = 0;
 
-    int slot = fs_find_by_name(name);
-    if (slot < 0) {
-        slot = fs_find_free_slot();
-        if (slot < 0) return -1; // no space
+    for (int i = 0; i < NODE_CACHE_SIZE; ++i) {
+        if (node_cache[i].lba == lba) {
+            node_cache[i].stamp = ++node_clock;
+            memcpy(out, &node_cache[i].node, sizeof(*out));
+            ctr_inc(CTR_FS_NODE_CACHE_HIT);
+            return 0;
+        }
+        if (node_cache[i].stamp < node_cache[victim].stamp) {
+            victim = i;
+        }
     }
 
-    struct dir_entry* e = &root_dir[slot];
+    ctr_inc(CTR_FS_NODE_READ);
+    node_cache[victim].lba = 0;
+    node_cache[victim].stamp = 0;
+    if (lba == 0 || lba >= sb.total_sectors) return FS_ECORRUPT;
+    if (blk_read(fs_dev, lba, 1, &node_cache[victim].node) < 0) return FS_EIO;
+    if (!node_valid(&node_cache[victim].node)) return FS_ECORRUPT;
 
-    // store name
-    for (int i = 0; i < 24; ++i) {
-        if (name[i] != '\0') {
-            e->name[i] = name[i];
-        } else {
-            e->name[i] = '\0';
+    node_cache[victim].lba = lba;
+    node_cache[victim].stamp = ++node_clock;
+    memcpy(out, &node_cache[victim].node, sizeof(*out));
+    return 0;
+}
+
+static void node_forget(uint32_t lba);
+
+// Write-through: the disk is always current, the cache only saves reads.
+// After a failed write the disk copy is unknown, so none is cached.
+static int node_write(uint32_t lba, const struct bt_node* n) {
+    int victim = 0;
+
+    if (blk_write(fs_dev, lba, 1, n) < 0) {
+        node_forget(lba);
+        return FS_EIO;
+    }
+
+    for (int i = 0; i < NODE_CACHE_SIZE; ++i) {
+        if (node_cache[i].lba == lba) {
+            victim = i;
             break;
         }
+        if (node_cache[i].stamp < node_cache[victim].stamp) {
+            victim = i;
+        }
     }
-    e->size = size;
-    e->used = 1;
+    memcpy(&node_cache[victim].node, n, sizeof(*n));
+    node_cache[victim].lba = lba;
+    node_cache[victim].stamp = ++node_clock;
+    return 0;
+}
 
-    // write data to disk
-    uint32_t lba = fs_slot_lba(slot);
-    uint8_t sector[SECTOR_SIZE];
-    uint32_t remaining = size;
-    const uint8_t* p = data;
-
-    for (uint32_t s = 0; s < FILE_SECTORS; ++s) {
-        for (int i = 0; i < SECTOR_SIZE; ++i) {
-            if (remaining > 0) {
-                sector[i] = *p++;
-                remaining--;
-            } else {
-                sector[i] = 0;
+static void node_forget(uint32_t lba) {
+    for (int i = 0; i < NODE_CACHE_SIZE; ++i) {
+        if (node_cache[i].lba == lba) {
+            node_cache[i].lba = 0;
+            node_cache[i].stamp = 0;
+        }
+    }
+}
+
+static void node_init(struct bt_node* n, int leaf) {
+    memset(n, 0, sizeof(*n));
+    n->magic = BT_MAGIC;
+    n->leaf = (uint8_t)leaf;
+}
+
+// ===== B-tree =====
+
+static int name_cmp(const char* a, const char* b) {
+    for (int i = 0; i < FS_NAME_MAX; ++i) {
+        if (a[i] != b[i]) {
+            return (unsigned char)a[i] - (unsigned char)b[i];
+        }
+        if (a[i] == '\0') break;
+    }
+    return 0;
+}
+
+static void name_copy(char* dst, const char* src) {
+    int i = 0;
+    for (; i < FS_NAME_MAX - 1 && src[i] != '\0'; ++i) {
+        dst[i] = src[i];
+    }
+    for (; i < FS_NAME_MAX; ++i) {
+        dst[i] = '\0';
+    }
+}
+
+static int bt_full(const struct bt_node* n) {
+    return n->count >= (n->leaf ? BT_LEAF_MAX : BT_KEYS_MAX);
+}
+
+// Child to descend into: separators equal to the name send it right
+static int bt_child_index(const struct bt_node* n, const char* name) {
+    int i = 0;
+    while (i < n->count && name_cmp(n->in.key[i], name) <= 0) {
+        i++;
+    }
+    return i;
+}
+
+// First record in a leaf whose name is >= `name`
+static int bt_leaf_index(const struct bt_node* n, const char* name) {
+    int i = 0;
+    while (i < n->count && name_cmp(n->rec[i].name, name) < 0) {
+        i++;
+    }
+    return i;
+}
+
+// Descend from `root` to the leaf that would hold `name`
+static int bt_find_leaf(uint32_t root, const char* name, struct bt_node* n, uint32_t* lba_out,
+                        uint32_t* visited) {
+    uint32_t lba = root;
+    int r = node_read(lba, n);
+    *visited = 1;
+    while (r == 0 && !n->leaf) {
+        lba = n->in.child[bt_child_index(n, name)];
+        r = node_read(lba, n);
+        (*visited)++;
+    }
+    *lba_out = lba;
+    return r;
+}
+
+static int bt_lookup(uint32_t root, const char* name, struct dir_entry* out) {
+    struct bt_node n;
+    uint32_t lba, visited;
+
+    ctr_inc(CTR_FS_LOOKUP);
+    int r = bt_find_leaf(root, name, &n, &lba, &visited);
+    if (r < 0) return r;
+
+    int i = bt_leaf_index(&n, name);
+    if (i < n.count && name_cmp(n.rec[i].name, name) == 0) {
+        if (out) *out = n.rec[i];
+        trace_event(EV_FS_LOOKUP, (n.rec[i].flags & DE_INLINE) ? 0 : n.rec[i].lba, visited, 0);
+        return 0;
+    }
+
+    ctr_inc(CTR_FS_LOOKUP_MISS);
+    trace_event(EV_FS_LOOKUP, (uint32_t)-1, visited, 0);
+    return FS_ENOENT;
+}
+
+// Split the full child at index `i` of `parent`; the upper half moves to a new
+// right sibling and a separator is added to the parent. All three are written.
+static int bt_split_child(struct bt_node* parent, uint32_t parent_lba, int i,
+                          struct bt_node* child, uint32_t child_lba,
+                          struct bt_node* right, uint32_t* right_lba_out) {
+    uint32_t right_lba = fs_alloc(1);
+    if (!right_lba) return FS_ENOSPC;
+
+    char sep[FS_NAME_MAX];
+    int m = child->count / 2;
+
+    node_init(right, child->leaf);
+    if (child->leaf) {
+        right->count = child->count - m;
+        memcpy(right->rec, &child->rec[m], right->count * sizeof(struct dir_entry));
+        child->count = m;
+        right->next = child->next;
+        child->next = right_lba;
+        name_copy(sep, right->rec[0].name);
+    } else {
+        // the middle key moves up instead of being copied
+        name_copy(sep, child->in.key[m]);
+        right->count = child->count - m - 1;
+        memcpy(right->in.key, child->in.key[m + 1], right->count * FS_NAME_MAX);
+        memcpy(right->in.child, &child->in.child[m + 1], (right->count + 1) * sizeof(uint32_t));
+        child->count = m;
+    }
+
+    for (int k = parent->count; k > i; --k) {
+        name_copy(parent->in.key[k], parent->in.key[k - 1]);
+        parent->in.child[k + 1] = parent->in.child[k];
+    }
+    name_copy(parent->in.key[i], sep);
+    parent->in.child[i + 1] = right_lba;
+    parent->count++;
+
+    // the new sibling first, so a failure leaves nothing pointing at it
+    int r = node_write(right_lba, right);
+    if (r == 0) r = node_write(child_lba, child);
+    if (r == 0) r = node_write(parent_lba, parent);
+    if (r < 0) {
+        node_forget(right_lba);
+        fs_free(right_lba, 1);
+        return r;
+    }
+
+    *right_lba_out = right_lba;
+    return 0;
+}
+
+// Insert a new record, splitting full nodes on the way down so a split never
+// has to propagate back up.
+static int bt_insert(uint32_t root, const struct dir_entry* e) {
+    struct bt_node node, child, right;
+    uint32_t right_lba;
+    int r;
+
+    r = node_read(root, &node);
+    if (r < 0) return r;
+    if (bt_full(&node)) {
+        // Grow a level: the root's contents move to a new left child so the
+        // root LBA (the directory's identity) stays put.
+        uint32_t left_lba = fs_alloc(1);
+        if (!left_lba) return FS_ENOSPC;
+
+        memcpy(&child, &node, sizeof(child));
+        node_init(&node, 0);
+        node.in.child[0] = left_lba;
+
+        r = bt_split_child(&node, root, 0, &child, left_lba, &right, &right_lba);
+        if (r < 0) {
+            fs_free(left_lba, 1);
+            return r;
+        }
+    }
+
+    uint32_t lba = root;
+    while (!node.leaf) {
+        int i = bt_child_index(&node, e->name);
+        uint32_t child_lba = node.in.child[i];
+        r = node_read(child_lba, &child);
+        if (r < 0) return r;
+
+        if (bt_full(&child)) {
+            r = bt_split_child(&node, lba, i, &child, child_lba, &right, &right_lba);
+            if (r < 0) return r;
+            if (name_cmp(e->name, node.in.key[i]) >= 0) {
+                memcpy(&child, &right, sizeof(child));
+                child_lba = right_lba;
+            }
+        }
+
+        memcpy(&node, &child, sizeof(node));
+        lba = child_lba;
+    }
+
+    int i = bt_leaf_index(&node, e->name);
+    for (int k = node.count; k > i; --k) {
+        node.rec[k] = node.rec[k - 1];
+    }
+    node.rec[i] = *e;
+    node.count++;
+    return node_write(lba, &node);
+}
+
+// Replace (e != NULL) or remove (e == NULL) the record called `name`
+static int bt_modify(uint32_t root, const char* name, const struct dir_entry* e) {
+    struct bt_node n;
+    uint32_t lba, visited;
+    int r = bt_find_leaf(root, name, &n, &lba, &visited);
+    if (r < 0) return r;
+
+    int i = bt_leaf_index(&n, name);
+    if (i >= n.count || name_cmp(n.rec[i].name, name) != 0) return FS_ENOENT;
+
+    if (e) {
+        n.rec[i] = *e;
+    } else {
+        for (int k = i; k < n.count - 1; ++k) {
+            n.rec[k] = n.rec[k + 1];
+        }
+        n.count--;
+    }
+    return node_write(lba, &n);
+}
+
+static int bt_first_leaf(uint32_t root, uint32_t* lba_out) {
+    struct bt_node n;
+    uint32_t lba = root;
+    int r = node_read(lba, &n);
+    while (r == 0 && !n.leaf) {
+        lba = n.in.child[0];
+        r = node_read(lba, &n);
+    }
+    *lba_out = lba;
+    return r;
+}
+
+// 1 if the tree holds no records, 0 if it does, negative on error
+static int bt_empty(uint32_t root) {
+    struct bt_node n;
+    uint32_t lba;
+    int r = bt_first_leaf(root, &lba);
+    for (; r == 0 && lba != 0; lba = n.next) {
+        r = node_read(lba, &n);
+        if (r == 0 && n.count > 0) return 0;
+    }
+    return r < 0 ? r : 1;
+}
+
+// A node that cannot be read keeps its children: leaking them is safer than
+// freeing sectors named by a corrupt pointer
+static void bt_free_tree(uint32_t lba) {
+    struct bt_node n;
+    if (node_read(lba, &n) < 0) return;
+    if (!n.leaf) {
+        for (int i = 0; i <= n.count; ++i) {
+            bt_free_tree(n.in.child[i]);
+        }
+    }
+    node_forget(lba);
+    fs_free(lba, 1);
+}
+
+static uint32_t bt_create(void) {
+    struct bt_node n;
+    uint32_t lba = fs_alloc(1);
+    if (!lba) return 0;
+    node_init(&n, 1);
+    if (node_write(lba, &n) < 0) {
+        fs_free(lba, 1);
+        return 0;
+    }
+    return lba;
+}
+
+// ===== Paths =====
+
+// Turn `path` (absolute, or relative to the cwd) into a canonical absolute
+// path with "." and ".." resolved. Component names are length checked.
+static int fs_normalize(const char* path, char* out) {
+    int len = 0;
+    const char* src[2] = { cwd, path };
+
+    for (int pass = (path[0] == '/') ? 1 : 0; pass < 2; ++pass) {
+        const char* p = src[pass];
+        while (*p) {
+            while (*p == '/') p++;
+            if (*p == '\0') break;
+
+            const char* comp = p;
+            int clen = 0;
+            while (p[clen] && p[clen] != '/') clen++;
+            p += clen;
+
+            if (clen == 1 && comp[0] == '.') continue;
+            if (clen == 2 && comp[0] == '.' && comp[1] == '.') {
+                while (len > 0 && out[len - 1] != '/') len--;
+                if (len > 0) len--;
+                continue;
+            }
+            if (clen >= FS_NAME_MAX || len + 1 + clen >= FS_PATH_MAX) return FS_EINVAL;
+
+            out[len++] = '/';
+            for (int i = 0; i < clen; ++i) {
+                out[len++] = comp[i];
             }
         }
-        ata_write_sector(lba + s, sector);
     }
 
-    fs_save_directory();
+    if (len == 0) out[len++] = '/';
+    out[len] = '\0';
     return 0;
 }
 
-int fs_read_file(const char* name, uint8_t* buffer, uint32_t buffer_size) {
-    int slot = fs_find_by_name(name);
-    if (slot < 0) return -1; // not found
+// Walk every component of a canonical path except the last. Returns the B-tree
+// root of the directory holding it and copies out the last name ("" for "/").
+static int fs_walk_parent(const char* abs, uint32_t* dir, char* leaf) {
+    uint32_t cur = sb.root_lba;
+    const char* p = abs + 1;
 
-    struct dir_entry* e = &root_dir[slot];
-    uint32_t size = e->size;
-    if (size > buffer_size) size = buffer_size;
+    for (;;) {
+        char name[FS_NAME_MAX];
+        int n = 0;
+        while (p[n] && p[n] != '/') {
+            name[n] = p[n];
+            n++;
+        }
+        name[n] = '\0';
+
+        if (p[n] == '\0') {
+            name_copy(leaf, name);
+            *dir = cur;
+            return 0;
+        }
+
+        struct dir_entry e;
+        int r = bt_lookup(cur, name, &e);
+        if (r < 0) return r;
+        if (e.type != FT_DIR) return FS_ENOTDIR;
+        cur = e.lba;
+        p += n + 1;
+    }
+}
+
+static int fs_resolve(const char* path, char* abs, uint32_t* dir, char* leaf) {
+    int r = fs_normalize(path, abs);
+    if (r < 0) return r;
+    return fs_walk_parent(abs, dir, leaf);
+}
+
+static int fs_stat_locked(const char* path, struct dir_entry* out) {
+    char abs[FS_PATH_MAX];
+    char leaf[FS_NAME_MAX];
+    uint32_t dir;
+
+    int r = fs_resolve(path, abs, &dir, leaf);
+    if (r < 0) return r;
+
+    if (leaf[0] == '\0') {
+        // the root has no record of its own
+        memset(out, 0, sizeof(*out));
+        out->name[0] = '/';
+        out->type = FT_DIR;
+        out->lba = sb.root_lba;
+        out->sectors = 1;
+        return 0;
+    }
+    return bt_lookup(dir, leaf, out);
+}
+
+// ===== Files and directories =====
+
+// Tiny files: the record is the whole file, so only its leaf is written
+static int fs_write_inline(uint32_t dir, const char* name, int exists, uint8_t flags,
+                           const uint8_t* data, uint32_t size,
+                           uint32_t old_lba, uint32_t old_sectors) {
+    struct dir_entry e;
+
+    memset(&e, 0, sizeof(e));
+    name_copy(e.name, name);
+    e.size = size;
+    e.type = FT_FILE;
+    e.flags = flags | DE_INLINE;
+    memcpy(e.inline_data, data, size);
+
+    int r = exists ? bt_modify(dir, name, &e) : bt_insert(dir, &e);
+    if (r < 0) return r;
+    fs_free(old_lba, old_sectors);
+    r = fs_flush();
+
+    ctr_inc(CTR_FS_WRITE);
+    ctr_add(CTR_FS_WRITE_BYTES, size);
+    trace_event(EV_FS_WRITE, 0, size, 0);
+    return r;
+}
+
+static int fs_write_file_opts_locked(const char* path, const uint8_t* data, uint32_t size, int mode) {
+    char abs[FS_PATH_MAX];
+    char name[FS_NAME_MAX];
+    uint32_t dir;
+    struct dir_entry e;
+
+    if (size > FS_MAX_FILE_SIZE) size = FS_MAX_FILE_SIZE;
+
+    int r = fs_resolve(path, abs, &dir, name);
+    if (r < 0) return r;
+    if (name[0] == '\0') return FS_EISDIR;
+
+    r = bt_lookup(dir, name, &e);
+    if (r < 0 && r != FS_ENOENT) return r;
+    int exists = (r == 0);
+    if (exists && e.type != FT_FILE) return FS_EISDIR;
+
+    int old_extent = exists && !(e.flags & DE_INLINE);
+    uint32_t old_lba = old_extent ? e.lba : 0;
+    uint32_t old_sectors = old_extent ? e.sectors : 0;
+
+    uint8_t flags = exists ? (e.flags & DE_NOCOMPRESS) : 0;
+    if (mode == FS_WRITE_COMPRESS) flags &= ~DE_NOCOMPRESS;
+    if (mode == FS_WRITE_RAW) flags |= DE_NOCOMPRESS;
+
+    if (size <= FS_INLINE_MAX) {
+        return fs_write_inline(dir, name, exists, flags, data, size, old_lba, old_sectors);
+    }
+
+    // Compress only if the result fits in fewer sectors than the raw data,
+    // otherwise the extra decode is pure cost.
+    const uint8_t* src = data;
+    uint32_t stored = size;
+    uint32_t raw_sectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if (!(flags & DE_NOCOMPRESS) && raw_sectors > 1) {
+        uint32_t z = lz_compress(data, size, zbuf, (raw_sectors - 1) * SECTOR_SIZE, &lz);
+        if (z) {
+            src = zbuf;
+            stored = z;
+            flags |= DE_COMPRESSED;
+        }
+    }
+
+    // New data always goes to a fresh extent; the old one is released only
+    // once the directory points at the new copy.
+    uint32_t sectors = (stored + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    uint32_t lba = 0;
+    if (sectors) {
+        lba = fs_alloc(sectors);
+        if (!lba) return FS_ENOSPC;
+    }
+
+    // Checksum each batch just before writing it, while it is still in cache
+    uint32_t crc = 0;
+    uint32_t full = stored / SECTOR_SIZE;
+    int err = 0;
+    for (uint32_t s = 0; s < full && !err; s += FS_IO_BATCH) {
+        uint32_t n = (full - s < FS_IO_BATCH) ? full - s : FS_IO_BATCH;
+        crc = crc32c(crc, src + s * SECTOR_SIZE, n * SECTOR_SIZE);
+        err = blk_write(fs_dev, lba + s, n, src + s * SECTOR_SIZE);
+    }
+    if (!err && full < sectors) {
+        uint8_t sector[SECTOR_SIZE];
+        uint32_t tail = stored - full * SECTOR_SIZE;
+        memcpy(sector, src + full * SECTOR_SIZE, tail);
+        memset(sector + tail, 0, SECTOR_SIZE - tail);
+        crc = crc32c(crc, sector, tail);
+        err = blk_write(fs_dev, lba + full, 1, sector);
+    }
+    if (err) {
+        fs_free(lba, sectors);
+        fs_flush();
+        return FS_EIO;
+    }
+
+    memset(&e, 0, sizeof(e));
+    name_copy(e.name, name);
+    e.size = size;
+    e.type = FT_FILE;
+    e.flags = flags | DE_CHECKSUM;
+    e.lba = lba;
+    e.sectors = sectors;
+    e.stored = stored;
+    e.crc = crc;
+
+    r = exists ? bt_modify(dir, name, &e) : bt_insert(dir, &e);
+    if (r < 0) {
+        fs_free(lba, sectors);
+        fs_flush();
+        return r;
+    }
+    fs_free(old_lba, old_sectors);
+    r = fs_flush();
+
+    ctr_inc(CTR_FS_WRITE);
+    ctr_add(CTR_FS_WRITE_BYTES, size);
+    ctr_add(CTR_FS_WRITE_STORED, stored);
+    trace_event(EV_FS_WRITE, lba, size, stored);
+    return r;
+}
 
-    uint32_t lba = fs_slot_lba(slot);
+int fs_write_file(const char* path, const uint8_t* data, uint32_t size) {
+    return fs_write_file_opts(path, data, size, FS_WRITE_DEFAULT);
+}
+
+static int fs_open_locked(const char* path, struct fs_file* f) {
+    struct dir_entry e;
+
+    int r = fs_stat_locked(path, &e);
+    if (r < 0) return r;
+    if (e.type != FT_FILE) return FS_EISDIR;
+
+    f->size = e.size;
+    f->flags = e.flags;
+    f->check_pos = 0;
+    f->check_crc = 0;
+    if (e.flags & DE_INLINE) {
+        if (e.size > FS_INLINE_MAX) return FS_ECORRUPT;
+        f->lba = 0;
+        f->sectors = 0;
+        f->stored = 0;
+        f->crc = 0;
+        memcpy(f->inline_data, e.inline_data, e.size);
+    } else {
+        // preads derive sector ranges from these, so they must stay inside the extent
+        if (e.sectors > sb.total_sectors || e.lba > sb.total_sectors - e.sectors ||
+            e.stored > e.sectors * SECTOR_SIZE ||
+            (!(e.flags & DE_COMPRESSED) && e.size > e.sectors * SECTOR_SIZE)) {
+            return FS_ECORRUPT;
+        }
+        f->lba = e.lba;
+        f->sectors = e.sectors;
+        f->stored = e.stored;
+        f->crc = e.crc;
+    }
+    return 0;
+}
+
+// Bring a compressed file's contents into zcache
+static int fs_load_compressed(const struct fs_file* f) {
+    if (zcache_lba == f->lba) return 0;
+
+    // `stored` comes from the directory record: it has to fit both zbuf and the extent
+    if (f->stored > sizeof(zbuf) || f->stored > f->sectors * SECTOR_SIZE) return FS_ECORRUPT;
+
+    uint32_t sectors = (f->stored + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if (blk_read(fs_dev, f->lba, sectors, zbuf) < 0) return FS_EIO;
+
+    if ((f->flags & DE_CHECKSUM) && crc32c(0, zbuf, f->stored) != f->crc) {
+        ctr_inc(CTR_FS_CRC_ERRORS);
+        return FS_ECORRUPT;
+    }
+
+    uint64_t start = rdtsc();
+    int n = lz_decompress(zbuf, f->stored, zcache, sizeof(zcache));
+    ctr_add(CTR_LZ_DECODE_CYCLES, rdtsc() - start);
+
+    if (n != (int)f->size) return FS_ECORRUPT;
+    zcache_lba = f->lba;
+    return 0;
+}
+
+static int fs_pread_locked(struct fs_file* f, uint32_t offset, uint8_t* buffer, uint32_t len) {
+    if (offset >= f->size) return 0;
+    if (len > f->size - offset) len = f->size - offset;
+
+    if (f->flags & DE_INLINE) {
+        memcpy(buffer, f->inline_data + offset, len);
+        ctr_inc(CTR_FS_READ);
+        ctr_add(CTR_FS_READ_BYTES, len);
+        trace_event(EV_FS_READ, 0, len, offset);
+        return len;
+    }
+
+    if (f->flags & DE_COMPRESSED) {
+        int r = fs_load_compressed(f);
+        if (r < 0) return r;
+        memcpy(buffer, zcache + offset, len);
+
+        ctr_inc(CTR_FS_READ);
+        ctr_add(CTR_FS_READ_BYTES, len);
+        trace_event(EV_FS_READ, f->lba, len, offset);
+        return len;
+    }
+
+    // A partial sector at either end goes through a bounce buffer; the whole
+    // sectors between them are read straight into the caller's buffer.
+    uint32_t lba = f->lba + offset / SECTOR_SIZE;
+    uint32_t skip = offset % SECTOR_SIZE;
     uint8_t sector[SECTOR_SIZE];
-    uint32_t remaining = size;
-    uint8_t* p = buffer;
-
-    for (uint32_t s = 0; s < FILE_SECTORS; ++s) {
-        ata_read_sector(lba + s, sector);
-        for (int i = 0; i < SECTOR_SIZE; ++i) {
-            if (remaining > 0) {
-                *p++ = sector[i];
-                remaining--;
-            } else {
+    uint32_t done = 0;
+
+    if (skip) {
+        uint32_t chunk = SECTOR_SIZE - skip;
+        if (chunk > len) chunk = len;
+        if (blk_read(fs_dev, lba++, 1, sector) < 0) return FS_EIO;
+        memcpy(buffer, sector + skip, chunk);
+        done = chunk;
+    }
+    uint32_t whole = (len - done) / SECTOR_SIZE;
+    if (whole) {
+        if (blk_read(fs_dev, lba, whole, buffer + done) < 0) return FS_EIO;
+        lba += whole;
+        done += whole * SECTOR_SIZE;
+    }
+    if (done < len) {
+        if (blk_read(fs_dev, lba, 1, sector) < 0) return FS_EIO;
+        memcpy(buffer + done, sector, len - done);
+        done = len;
+    }
+
+    ctr_inc(CTR_FS_READ);
+    ctr_add(CTR_FS_READ_BYTES, done);
+    trace_event(EV_FS_READ, f->lba, done, offset);
+
+    // Raw data is stored as-is, so sequential reads can extend the checksum
+    if ((f->flags & DE_CHECKSUM) && offset == f->check_pos) {
+        f->check_crc = crc32c(f->check_crc, buffer, done);
+        f->check_pos += done;
+        if (f->check_pos == f->stored && f->check_crc != f->crc) {
+            ctr_inc(CTR_FS_CRC_ERRORS);
+            return FS_ECORRUPT;
+        }
+    }
+    return done;
+}
+
+static int fs_read_file_locked(const char* path, uint8_t* buffer, uint32_t buffer_size) {
+    struct fs_file f;
+
+    int r = fs_open_locked(path, &f);
+    if (r < 0) return r;
+    return fs_pread_locked(&f, 0, buffer, buffer_size);
+}
+
+static int fs_mkdir_locked(const char* path) {
+    char abs[FS_PATH_MAX];
+    char name[FS_NAME_MAX];
+    uint32_t dir;
+    struct dir_entry e;
+
+    int r = fs_resolve(path, abs, &dir, name);
+    if (r < 0) return r;
+    if (name[0] == '\0') return FS_EEXIST;
+    r = bt_lookup(dir, name, 0);
+    if (r == 0) return FS_EEXIST;
+    if (r != FS_ENOENT) return r;
+
+    uint32_t root = bt_create();
+    if (!root) return FS_ENOSPC;
+
+    memset(&e, 0, sizeof(e));
+    name_copy(e.name, name);
+    e.type = FT_DIR;
+    e.lba = root;
+    e.sectors = 1;
+
+    r = bt_insert(dir, &e);
+    if (r < 0) {
+        node_forget(root);
+        fs_free(root, 1);
+    }
+    int f = fs_flush();
+    return r < 0 ? r : f;
+}
+
+static int fs_delete_file_locked(const char* path) {
+    char abs[FS_PATH_MAX];
+    char name[FS_NAME_MAX];
+    uint32_t dir;
+    struct dir_entry e;
+
+    int r = fs_resolve(path, abs, &dir, name);
+    if (r < 0) return r;
+    if (name[0] == '\0') return FS_EINVAL;
+
+    r = bt_lookup(dir, name, &e);
+    if (r < 0) return r;
+
+    if (e.type == FT_DIR) {
+        // refuse to remove the cwd or one of its ancestors
+        int n = 0;
+        while (abs[n] && abs[n] == cwd[n]) n++;
+        if (abs[n] == '\0' && (cwd[n] == '\0' || cwd[n] == '/')) return FS_EINVAL;
+        r = bt_empty(e.lba);
+        if (r < 0) return r;
+        if (r == 0) return FS_ENOTEMPTY;
+    }
+
+    r = bt_modify(dir, name, 0);
+    if (r < 0) return r;
+
+    uint32_t lba = (e.flags & DE_INLINE) ? 0 : e.lba;
+    if (e.type == FT_DIR) {
+        bt_free_tree(e.lba);
+    } else if (lba) {
+        fs_free(e.lba, e.sectors);
+    }
+    r = fs_flush();
+
+    ctr_inc(CTR_FS_DELETE);
+    trace_event(EV_FS_DELETE, lba, 0, 0);
+    return r;
+}
+
+static int fs_chdir_locked(const char* path) {
+    char abs[FS_PATH_MAX];
+    struct dir_entry e;
+
+    int r = fs_normalize(path, abs);
+    if (r < 0) return r;
+    r = fs_stat_locked(abs, &e);
+    if (r < 0) return r;
+    if (e.type != FT_DIR) return FS_ENOTDIR;
+
+    for (int i = 0; i < FS_PATH_MAX; ++i) {
+        cwd[i] = abs[i];
+        if (abs[i] == '\0') break;
+    }
+    return 0;
+}
+
+const char* fs_getcwd(void) {
+    return cwd;
+}
+
+static int fs_opendir_locked(const char* path, struct fs_dir* d) {
+    struct dir_entry e;
+
+    int r = fs_stat_locked(path, &e);
+    if (r < 0) return r;
+    if (e.type != FT_DIR) return FS_ENOTDIR;
+
+    d->index = 0;
+    return bt_first_leaf(e.lba, &d->leaf);
+}
+
+static int fs_readdir_locked(struct fs_dir* d, struct dir_entry* out) {
+    struct bt_node n;
+
+    while (d->leaf != 0) {
+        int r = node_read(d->leaf, &n);
+        if (r < 0) {
+            d->leaf = 0;
+            return r;
+        }
+        if (d->index < n.count) {
+            *out = n.rec[d->index++];
+            return 1;
+        }
+        d->leaf = n.next;
+        d->index = 0;
+    }
+    return 0;
+}
+
+const char* fs_strerror(int err) {
+    switch (err) {
+    case FS_ENOENT:    return "No such file or directory";
+    case FS_ENOSPC:    return "No space left on disk";
+    case FS_EEXIST:    return "Already exists";
+    case FS_ENOTDIR:   return "Not a directory";
+    case FS_EISDIR:    return "Is a directory";
+    case FS_ENOTEMPTY: return "Directory not empty";
+    case FS_EINVAL:    return "Invalid path";
+    case FS_ECORRUPT:  return "File data is corrupt";
+    case FS_EIO:       return "I/O error";
+    case FS_ENOFS:     return "No filesystem on the device (see format)";
+    default:           return "Unknown error";
+    }
+}
+
+static void fs_scrub_dir(uint32_t root, char* path, int len, struct fs_scrub_result* res,
+                         void (*on_bad)(const char* path, void* ctx), void* ctx) {
+    struct fs_dir d;
+    struct dir_entry e;
+
+    res->dirs++;
+    d.index = 0;
+    int r = bt_first_leaf(root, &d.leaf);
+
+    while (r >= 0 && (r = fs_readdir_locked(&d, &e)) > 0) {
+        int n = len;
+        path[n++] = '/';
+        for (int i = 0; e.name[i] && n < FS_PATH_MAX - 1; ++i) {
+            path[n++] = e.name[i];
+        }
+        path[n] = '\0';
+
+        if (e.type == FT_DIR) {
+            fs_scrub_dir(e.lba, path, n, res, on_bad, ctx);
+            continue;
+        }
+
+        res->files++;
+        if (e.flags & DE_INLINE) {
+            res->inlined++;
+            if (e.size > FS_INLINE_MAX) {
+                res->bad++;
+                if (on_bad) on_bad(path, ctx);
+            }
+            continue;
+        }
+        if (!(e.flags & DE_CHECKSUM)) {
+            res->unchecked++;
+            continue;
+        }
+
+        // a record whose extent cannot be right is bad without reading it
+        if (e.sectors > sizeof(zbuf) / SECTOR_SIZE || e.stored > e.sectors * SECTOR_SIZE) {
+            res->bad++;
+            if (on_bad) on_bad(path, ctx);
+            continue;
+        }
+
+        uint64_t t0 = rdtsc();
+        int err = e.sectors ? blk_read(fs_dev, e.lba, e.sectors, zbuf) : 0;
+        uint64_t t1 = rdtsc();
+        uint32_t crc = err ? ~e.crc : crc32c(0, zbuf, e.stored);
+        uint64_t t2 = rdtsc();
+
+        res->bytes += e.stored;
+        res->read_cycles += t1 - t0;
+        res->crc_cycles += t2 - t1;
+
+        if (crc != e.crc) {
+            res->bad++;
+            ctr_inc(CTR_FS_CRC_ERRORS);
+            if (on_bad) on_bad(path, ctx);
+        }
+    }
+
+    // an unreadable directory node counts against the directory itself
+    if (r < 0) {
+        path[len] = '\0';
+        res->bad++;
+        if (on_bad) on_bad(len ? path : "/", ctx);
+    }
+}
+
+static void fs_scrub_locked(struct fs_scrub_result* res, void (*on_bad)(const char* path, void* ctx), void* ctx) {
+    char path[FS_PATH_MAX];
+
+    memset(res, 0, sizeof(*res));
+    path[0] = '\0';
+    fs_scrub_dir(sb.root_lba, path, 0, res, on_bad, ctx);
+}
+
+static void fs_drop_caches_locked(void) {
+    for (int i = 0; i < NODE_CACHE_SIZE; ++i) {
+        node_cache[i].lba = 0;
+        node_cache[i].stamp = 0;
+    }
+    zcache_lba = 0;
+}
+
+// ===== Mount / format =====
+
+// The pre-B-tree layout: a flat 256-entry table at DIR_START_LBA and one
+// FILE_SECTORS slot per entry from DATA_START_LBA. Only read to migrate.
+struct flat_entry {
+    char     name[24];
+    uint32_t size;
+    uint8_t  used;
+    uint8_t  _pad[3];
+} __attribute__((packed));
+
+static struct flat_entry flat_dir[MAX_FILES];
+
+static int fs_load_flat_directory(void) {
+    uint8_t* p = (uint8_t*)flat_dir;
+    int files = 0;
+
+    if (blk_read(fs_dev, DIR_START_LBA, DIR_SECTORS, p) < 0) return 0;
+
+    // only trust the table if every record looks like one
+    for (int i = 0; i < MAX_FILES; ++i) {
+        struct flat_entry* f = &flat_dir[i];
+        if (f->used > 1) return 0;
+        if (!f->used) continue;
+        if (f->size > FS_MAX_FILE_SIZE || f->name[0] == '\0') return 0;
+
+        int terminated = 0;
+        for (int j = 0; j < 24; ++j) {
+            if (f->name[j] == '\0') {
+                terminated = 1;
                 break;
             }
         }
-        if (remaining == 0) break;
+        if (!terminated) return 0;
+        files++;
     }
+    return files;
+}
+
+// Every used flat slot must hold its data inside its own FILE_SECTORS slot
+// and below the bitmap a format of `capacity` sectors puts at the end.
+static int flat_slots_fit(uint32_t capacity) {
+    uint32_t bitmap_sectors = (capacity + BITS_PER_SECTOR - 1) / BITS_PER_SECTOR;
+    uint32_t data_end = capacity - bitmap_sectors;
 
-    return size;
+    for (int i = 0; i < MAX_FILES; ++i) {
+        if (!flat_dir[i].used) continue;
+        uint32_t lba = DATA_START_LBA + (uint32_t)i * FILE_SECTORS;
+        uint32_t sectors = (flat_dir[i].size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        if (sectors > FILE_SECTORS || lba > data_end || sectors > data_end - lba) return 0;
+    }
+    return 1;
 }
 
-int fs_delete_file(const char* name) {
-    int slot = fs_find_by_name(name);
-    if (slot < 0) return -1; // not found
+// Lay down a fresh superblock, bitmap and root directory. With `migrate`,
+// the files of an old flat-layout image are carried over in place; an image
+// whose slots don't fit is refused before anything is written.
+static int fs_format_locked(uint32_t capacity, int migrate) {
+    if (migrate && !flat_slots_fit(capacity)) return FS_ECORRUPT;
 
-    struct dir_entry* e = &root_dir[slot];
-    e->used = 0;
-    e->size = 0;
-    e->name[0] = '\0';
+    memset(&sb, 0, sizeof(sb));
+    sb.magic = FS_MAGIC;
+    sb.version = FS_VERSION;
+    sb.total_sectors = capacity;
+    sb.bitmap_sectors = (sb.total_sectors + BITS_PER_SECTOR - 1) / BITS_PER_SECTOR;
+    sb.bitmap_lba = sb.total_sectors - sb.bitmap_sectors;
 
-    /* Zero out the file's data sectors to avoid leftover data */
-    uint8_t sector[SECTOR_SIZE];
-    for (int i = 0; i < SECTOR_SIZE; ++i) sector[i] = 0;
-    uint32_t lba = fs_slot_lba(slot);
-    for (uint32_t s = 0; s < FILE_SECTORS; ++s) {
-        ata_write_sector(lba + s, sector);
+    memset(fs_bitmap, 0, sizeof(fs_bitmap));
+    free_sectors = sb.total_sectors;
+    bits_assign(0, 1, 1);
+    bits_assign(sb.bitmap_lba, sb.bitmap_sectors, 1);
+    free_sectors -= 1 + sb.bitmap_sectors;
+
+    // Old files keep their data where it is: reserve the used part of each
+    // slot before anything else is allocated.
+    for (int i = 0; migrate && i < MAX_FILES; ++i) {
+        if (flat_dir[i].used) {
+            uint32_t sectors = (flat_dir[i].size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+            bits_assign(DATA_START_LBA + (uint32_t)i * FILE_SECTORS, sectors, 1);
+            free_sectors -= sectors;
+        }
+    }
+
+    alloc_hint = 1;
+    sb.root_lba = bt_create();
+    if (!sb.root_lba) return FS_EIO;
+
+    for (int i = 0; migrate && i < MAX_FILES; ++i) {
+        if (flat_dir[i].used) {
+            struct dir_entry e;
+            memset(&e, 0, sizeof(e));
+            name_copy(e.name, flat_dir[i].name);
+            e.size = flat_dir[i].size;
+            e.type = FT_FILE;
+            e.lba = DATA_START_LBA + (uint32_t)i * FILE_SECTORS;
+            e.sectors = (e.size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+            e.stored = e.size;
+            int r = bt_lookup(sb.root_lba, e.name, 0);
+            if (r == FS_ENOENT) r = bt_insert(sb.root_lba, &e);
+            if (r < 0) return r;
+        }
+    }
+
+    for (uint32_t i = 0; i < sb.bitmap_sectors; ++i) {
+        bitmap_dirty[i] = 1;
+    }
+    if (fs_flush() < 0 || blk_write(fs_dev, 0, 1, &sb) < 0) return FS_EIO;
+    return blk_flush(fs_dev) < 0 ? FS_EIO : 0;
+}
+
+// Make `dev` the current device with empty caches; returns the sectors the
+// filesystem may use, or FS_EINVAL if the device is too small
+static int fs_attach(struct blkdev* dev) {
+    uint32_t capacity = blk_capacity(dev);
+    if (capacity > FS_MAX_SECTORS) capacity = FS_MAX_SECTORS;
+    if (capacity < FS_MIN_SECTORS) return FS_EINVAL;
+
+    fs_dev = dev;
+    fs_drop_caches_locked();
+    memset(bitmap_dirty, 0, sizeof(bitmap_dirty));
+    cwd[0] = '/';
+    cwd[1] = '\0';
+    return (int)capacity;
+}
+
+static int fs_mount_locked(struct blkdev* dev) {
+    int capacity = fs_attach(dev);
+    if (capacity < 0) return capacity;
+
+    if (blk_read(dev, 0, 1, &sb) < 0) return FS_EIO;
+
+    if (sb.magic != FS_MAGIC) {
+        if (fs_load_flat_directory() > 0) return fs_format_locked((uint32_t)capacity, 1);
+        return FS_ENOFS;
+    }
+    if (sb.version != FS_VERSION || sb.total_sectors > (uint32_t)capacity) return FS_ECORRUPT;
+
+    // the bitmap is read straight into fs_bitmap, so its extent must be exact
+    if (sb.total_sectors < FS_MIN_SECTORS ||
+        sb.bitmap_sectors != (sb.total_sectors + BITS_PER_SECTOR - 1) / BITS_PER_SECTOR ||
+        sb.bitmap_sectors > sizeof(fs_bitmap) / SECTOR_SIZE ||
+        sb.bitmap_lba > sb.total_sectors - sb.bitmap_sectors) {
+        return FS_ECORRUPT;
     }
 
-    fs_save_directory();
+    if (blk_read(dev, sb.bitmap_lba, sb.bitmap_sectors, fs_bitmap) < 0) return FS_EIO;
+
+    free_sectors = 0;
+    for (uint32_t i = 0; i < sb.total_sectors; ++i) {
+        if (!bit_test(i)) free_sectors++;
+    }
+    alloc_hint = 1;
     return 0;
 }
 
-void fs_init(void){
-    fs_load_directory();
-}
\ No newline at end of file
+struct blkdev* fs_device(void) {
+    return fs_dev;
+}
+
+// ===== Locked entry points =====
+
+int fs_stat(const char* path, struct dir_entry* out) {
+    spin_lock(&fs_lock);
+    int r = fs_stat_locked(path, out);
+    spin_unlock(&fs_lock);
+    return r;
+}
+
+int fs_write_file_opts(const char* path, const uint8_t* data, uint32_t size, int mode) {
+    spin_lock(&fs_lock);
+    int r = fs_write_file_opts_locked(path, data, size, mode);
+    spin_unlock(&fs_lock);
+    return r;
+}
+
+int fs_open(const char* path, struct fs_file* f) {
+    spin_lock(&fs_lock);
+    int r = fs_open_locked(path, f);
+    spin_unlock(&fs_lock);
+    return r;
+}
+
+int fs_pread(struct fs_file* f, uint32_t offset, uint8_t* buffer, uint32_t len) {
+    spin_lock(&fs_lock);
+    int r = fs_pread_locked(f, offset, buffer, len);
+    spin_unlock(&fs_lock);
+    return r;
+}
+
+int fs_read_file(const char* path, uint8_t* buffer, uint32_t buffer_size) {
+    spin_lock(&fs_lock);
+    int r = fs_read_file_locked(path, buffer, buffer_size);
+    spin_unlock(&fs_lock);
+    return r;
+}
+
+int fs_mkdir(const char* path) {
+    spin_lock(&fs_lock);
+    int r = fs_mkdir_locked(path);
+    spin_unlock(&fs_lock);
+    return r;
+}
+
+int fs_delete_file(const char* path) {
+    spin_lock(&fs_lock);
+    int r = fs_delete_file_locked(path);
+    spin_unlock(&fs_lock);
+    return r;
+}
+
+int fs_chdir(const char* path) {
+    spin_lock(&fs_lock);
+    int r = fs_chdir_locked(path);
+    spin_unlock(&fs_lock);
+    return r;
+}
+
+int fs_opendir(const char* path, struct fs_dir* d) {
+    spin_lock(&fs_lock);
+    int r = fs_opendir_locked(path, d);
+    spin_unlock(&fs_lock);
+    return r;
+}
+
+int fs_readdir(struct fs_dir* d, struct dir_entry* out) {
+    spin_lock(&fs_lock);
+    int r = fs_readdir_locked(d, out);
+    spin_unlock(&fs_lock);
+    return r;
+}
+
+void fs_scrub(struct fs_scrub_result* res, void (*on_bad)(const char* path, void* ctx), void* ctx) {
+    spin_lock(&fs_lock);
+    fs_scrub_locked(res, on_bad, ctx);
+    spin_unlock(&fs_lock);
+}
+
+void fs_drop_caches(void) {
+    spin_lock(&fs_lock);
+    fs_drop_caches_locked();
+    spin_unlock(&fs_lock);
+}
+
+int fs_mount(struct blkdev* dev) {
+    spin_lock(&fs_lock);
+    int r = fs_mount_locked(dev);
+    spin_unlock(&fs_lock);
+    return r;
+}
+
+int fs_format(struct blkdev* dev) {
+    spin_lock(&fs_lock);
+    int r = fs_attach(dev);
+    if (r >= 0) r = fs_format_locked((uint32_t)r, 0);
+    spin_unlock(&fs_lock);
+    return r;
+}
@@ -3,22 +3,143 @@
 
 #include <stdint.h>
 #include "ata.h"
+#include "blkdev.h"
 
+#define FS_MAX_FILE_SIZE  (FILE_SECTORS * SECTOR_SIZE)
+#define FS_NAME_MAX       24        // including the terminating NUL
+#define FS_PATH_MAX       128
+#define FS_INLINE_MAX     32        // files up to this size live in their dir_entry
+
+#define FT_FILE           1
+#define FT_DIR            2
+
+// dir_entry.flags
+#define DE_COMPRESSED     0x01      // data on disk is an LZ block of `stored` bytes
+#define DE_NOCOMPRESS     0x02      // the file opted out of compression
+#define DE_CHECKSUM       0x04      // `crc` is valid (files from older images have none)
+#define DE_INLINE         0x08      // the data is in `inline_data`, no extent
+
+// fs_write_file_opts modes
+#define FS_WRITE_DEFAULT  0         // keep the file's setting; new files try compression
+#define FS_WRITE_COMPRESS 1         // compress when it saves at least one sector
+#define FS_WRITE_RAW      2         // always store raw
+
+// Error codes (negative) returned by the fs_* calls
+#define FS_ENOENT         -1
+#define FS_ENOSPC         -2
+#define FS_EEXIST         -3
+#define FS_ENOTDIR        -4
+#define FS_EISDIR         -5
+#define FS_ENOTEMPTY      -6
+#define FS_EINVAL         -7
+#define FS_ECORRUPT       -8
+#define FS_EIO            -9
+#define FS_ENOFS          -10       // the device holds no TinyFS
+
+// One directory record, stored in the leaves of the directory's B-tree.
+// For a directory `lba` is the root node of its own B-tree. A file of at
+// most FS_INLINE_MAX bytes keeps its data in place of the extent fields, so
+// it is read along with the directory leaf and written with it.
 struct dir_entry {
-    char     name[24];
+    char     name[FS_NAME_MAX];
     uint32_t size;
-    uint8_t  used;
-    uint8_t  _pad[3];
+    uint8_t  type;
+    uint8_t  flags;
+    uint8_t  _pad[2];
+    union {
+        struct {
+            uint32_t lba;
+            uint32_t sectors;
+            uint32_t stored;        // bytes on disk, differs from size when compressed
+            uint32_t crc;           // CRC-32C of the `stored` bytes as they are on disk
+            uint8_t  _reserved[16];
+        };
+        uint8_t inline_data[FS_INLINE_MAX];
+    };
 } __attribute__((packed));
 
-extern struct dir_entry root_dir[MAX_FILES];
+// Handle returned by fs_open for reading a file piecewise with fs_pread
+struct fs_file {
+    uint32_t lba;
+    uint32_t sectors;               // length of the extent
+    uint32_t size;
+    uint32_t stored;
+    uint8_t  flags;
+    uint32_t crc;
+    uint32_t check_pos;             // raw files: bytes checksummed so far by sequential preads
+    uint32_t check_crc;
+    uint8_t  inline_data[FS_INLINE_MAX];
+};
+
+struct fs_scrub_result {
+    uint32_t files;
+    uint32_t dirs;
+    uint32_t unchecked;             // files without a checksum
+    uint32_t inlined;               // files stored in their directory record
+    uint32_t bad;
+    uint64_t bytes;                 // stored bytes read back
+    uint64_t read_cycles;
+    uint64_t crc_cycles;
+};
+
+// Directory iterator: a position in the B-tree's linked leaf level
+struct fs_dir {
+    uint32_t leaf;
+    uint32_t index;
+};
+
+// Every call is safe from any CPU; they are serialised by one lock. The
+// working directory is shared, so code off the shell should use absolute paths.
+int fs_read_file(const char* path, uint8_t* buffer, uint32_t buffer_size);
+
+int fs_write_file(const char* path, const uint8_t* data, uint32_t size);
+
+int fs_write_file_opts(const char* path, const uint8_t* data, uint32_t size, int mode);
+
+// Removes a file, or a directory if it is empty
+int fs_delete_file(const char* path);
+
+int fs_open(const char* path, struct fs_file* f);
+
+// Read up to `len` bytes at `offset`, touching only the sectors that cover
+// them. Returns the byte count, 0 at end of file. Reading a file front to
+// back checks its CRC; the read that completes it returns FS_ECORRUPT on a
+// mismatch (the data is still copied out).
+int fs_pread(struct fs_file* f, uint32_t offset, uint8_t* buffer, uint32_t len);
+
+int fs_stat(const char* path, struct dir_entry* out);
+
+int fs_mkdir(const char* path);
+
+int fs_chdir(const char* path);
+
+const char* fs_getcwd(void);
+
+int fs_opendir(const char* path, struct fs_dir* d);
+
+// Returns 1 and fills `out` per entry, in name order; 0 at the end, or a
+// negative error if a directory node cannot be read.
+int fs_readdir(struct fs_dir* d, struct dir_entry* out);
+
+const char* fs_strerror(int err);
+
+// Read back every file on the disk and check it against its CRC; `on_bad`
+// gets the path of each file that fails. It runs with the filesystem locked
+// and must not call back into fs_*.
+void fs_scrub(struct fs_scrub_result* res, void (*on_bad)(const char* path, void* ctx), void* ctx);
 
-int fs_read_file(const char* name, uint8_t* buffer, uint32_t buffer_size);
+// Forget cached nodes and decompressed data so the next reads go to disk
+void fs_drop_caches(void);
 
-int fs_write_file(const char* name, const uint8_t* data, uint32_t size);
+// Mount the filesystem on `dev`. A disk in the old flat layout is migrated;
+// one holding no TinyFS gives FS_ENOFS and is left untouched. Devices over
+// 512 MiB are only partly used.
+int fs_mount(struct blkdev* dev);
 
-int fs_delete_file(const char* name);
+// Write an empty filesystem to `dev` and mount it, destroying what it held
+int fs_format(struct blkdev* dev);
 
-void fs_init(void);
+// The mounted device, NULL before the first fs_mount
+struct blkdev* fs_device(void);
 
-#endif
\ No newline at end of file
+#endif
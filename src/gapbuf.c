@@ -0,0 +1,58 @@
+#include "gapbuf.h"
+#include "kstring.h"
+#include <stdint.h>
+
+void gb_init(struct gapbuf* gb, uint8_t* storage, uint32_t cap) {
+    gb->buf = storage;
+    gb->cap = cap;
+    gb->gap_start = 0;
+    gb->gap_end = cap;
+}
+
+void gb_adopt(struct gapbuf* gb, uint32_t len) {
+    if (len > gb->cap) len = gb->cap;
+
+    // the text is at [0, len); slide it behind the gap
+    memmove(gb->buf + gb->cap - len, gb->buf, len);
+    gb->gap_start = 0;
+    gb->gap_end = gb->cap - len;
+}
+
+void gb_move_to(struct gapbuf* gb, uint32_t pos) {
+    uint32_t len = gb_length(gb);
+    if (pos > len) pos = len;
+
+    if (pos < gb->gap_start) {
+        uint32_t n = gb->gap_start - pos;
+        memmove(gb->buf + gb->gap_end - n, gb->buf + pos, n);
+        gb->gap_start -= n;
+        gb->gap_end -= n;
+    } else if (pos > gb->gap_start) {
+        uint32_t n = pos - gb->gap_start;
+        memmove(gb->buf + gb->gap_start, gb->buf + gb->gap_end, n);
+        gb->gap_start += n;
+        gb->gap_end += n;
+    }
+}
+
+int gb_insert(struct gapbuf* gb, uint8_t c) {
+    if (gb->gap_start == gb->gap_end) return -1;   // full
+
+    gb->buf[gb->gap_start++] = c;
+    return 0;
+}
+
+int gb_backspace(struct gapbuf* gb) {
+    if (gb->gap_start == 0) return -1;
+    return gb->buf[--gb->gap_start];
+}
+
+int gb_delete(struct gapbuf* gb) {
+    if (gb->gap_end == gb->cap) return -1;
+    return gb->buf[gb->gap_end++];
+}
+
+const uint8_t* gb_contiguous(struct gapbuf* gb) {
+    gb_move_to(gb, gb_length(gb));
+    return gb->buf;
+}
@@ -0,0 +1,51 @@
+#ifndef GAPBUF_H
+#define GAPBUF_H
+
+#include <stdint.h>
+
+// Text buffer with the free space kept at the cursor, so inserting and
+// deleting there is O(1). Moving the cursor moves the gap, costing O(distance).
+//
+//   buf: [ text before cursor | gap ... | text after cursor ]
+//          0          gap_start      gap_end             cap
+struct gapbuf {
+    uint8_t* buf;
+    uint32_t cap;
+    uint32_t gap_start;
+    uint32_t gap_end;
+};
+
+void gb_init(struct gapbuf* gb, uint8_t* storage, uint32_t cap);
+
+// Take over `len` bytes already sitting at the start of the storage; the
+// cursor is left at position 0.
+void gb_adopt(struct gapbuf* gb, uint32_t len);
+
+static inline uint32_t gb_length(const struct gapbuf* gb) {
+    return gb->cap - (gb->gap_end - gb->gap_start);
+}
+
+static inline uint32_t gb_cursor(const struct gapbuf* gb) {
+    return gb->gap_start;
+}
+
+static inline uint8_t gb_at(const struct gapbuf* gb, uint32_t pos) {
+    return (pos < gb->gap_start) ? gb->buf[pos]
+                                 : gb->buf[pos + (gb->gap_end - gb->gap_start)];
+}
+
+void gb_move_to(struct gapbuf* gb, uint32_t pos);
+
+int gb_insert(struct gapbuf* gb, uint8_t c);
+
+// Delete the byte before the cursor; returns it, or -1 at the start.
+int gb_backspace(struct gapbuf* gb);
+
+// Delete the byte under the cursor; returns it, or -1 at the end.
+int gb_delete(struct gapbuf* gb);
+
+// Close the gap by moving it to the end and return the text as one run of
+// gb_length() bytes, ready to hand to the filesystem without another copy.
+const uint8_t* gb_contiguous(struct gapbuf* gb);
+
+#endif
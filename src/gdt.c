@@ -0,0 +1,74 @@
+#include "gdt.h"
+#include "percpu.h"
+#include "kstring.h"
+#include <stdint.h>
+
+struct gdt_entry {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t  base_mid;
+    uint8_t  access;
+    uint8_t  flags_limit;           // granularity/size flags in the top nibble
+    uint8_t  base_high;
+} __attribute__((packed));
+
+struct gdt_ptr {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+
+// Only ss0/esp0 are used: there is no hardware task switching
+struct tss {
+    uint32_t prev;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t unused[22];
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed));
+
+#define GDT_FIXED  6                // null, 4 code/data, TSS; per-CPU entries follow
+
+static struct gdt_entry gdt[GDT_FIXED + MAX_CPUS] __attribute__((aligned(8)));
+static struct gdt_ptr gdtp;
+static struct tss tss __attribute__((aligned(16)));
+
+// boot.s: load the GDT, reload every segment register, then the task register
+extern void gdt_flush(uint32_t gdtp, uint32_t code, uint32_t data, uint32_t tss);
+
+static void gdt_set(int i, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    gdt[i].limit_low = limit & 0xFFFF;
+    gdt[i].base_low = base & 0xFFFF;
+    gdt[i].base_mid = (base >> 16) & 0xFF;
+    gdt[i].access = access;
+    gdt[i].flags_limit = (uint8_t)((flags << 4) | ((limit >> 16) & 0x0F));
+    gdt[i].base_high = (base >> 24) & 0xFF;
+}
+
+void gdt_init(void) {
+    gdt_set(0, 0, 0, 0, 0);
+    gdt_set(1, 0, 0xFFFFF, 0x9A, 0xC);          // kernel code, ring 0, 4 GiB
+    gdt_set(2, 0, 0xFFFFF, 0x92, 0xC);          // kernel data
+    gdt_set(3, 0, 0xFFFFF, 0xFA, 0xC);          // user code, ring 3
+    gdt_set(4, 0, 0xFFFFF, 0xF2, 0xC);          // user data
+
+    memset(&tss, 0, sizeof(tss));
+    tss.ss0 = GDT_KERNEL_DATA;
+    tss.iomap_base = sizeof(tss);               // no I/O bitmap: ring 3 gets no ports
+    gdt_set(5, (uint32_t)&tss, sizeof(tss) - 1, 0x89, 0x0);
+
+    // byte-granular, so an access past the CPU's own entry faults
+    for (int i = 0; i < MAX_CPUS; ++i) {
+        percpu[i].id = (uint32_t)i;
+        gdt_set(GDT_FIXED + i, (uint32_t)&percpu[i], sizeof(percpu[i]) - 1, 0x92, 0x4);
+    }
+
+    gdtp.limit = sizeof(gdt) - 1;
+    gdtp.base = (uint32_t)&gdt;
+    gdt_flush((uint32_t)&gdtp, GDT_KERNEL_CODE, GDT_KERNEL_DATA, GDT_TSS);
+    __asm__ __volatile__ ("mov %0, %%gs" : : "r"(GDT_PERCPU));
+}
+
+void tss_set_kernel_stack(uint32_t esp0) {
+    tss.esp0 = esp0;
+}
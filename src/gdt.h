@@ -0,0 +1,24 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include <stdint.h>
+
+// Selectors. SYSENTER/SYSEXIT derive their segments from the kernel code
+// selector, so the four code/data descriptors must stay in this order.
+#define GDT_KERNEL_CODE  0x08
+#define GDT_KERNEL_DATA  0x10
+#define GDT_USER_CODE    0x1B       // 0x18 | RPL 3
+#define GDT_USER_DATA    0x23       // 0x20 | RPL 3
+#define GDT_TSS          0x28
+#define GDT_PERCPU       0x30       // + 8 * cpu: the %gs segment of each CPU, see percpu.h
+
+// Replace GRUB's GDT with flat kernel and user segments, one per-CPU segment
+// for every possible CPU, and load the TSS and the boot CPU's %gs. Other
+// CPUs load the same table and only their own %gs; they run no user code, so
+// the single TSS is the boot CPU's.
+void gdt_init(void);
+
+// Stack the CPU switches to when an interrupt or int 0x80 arrives from ring 3
+void tss_set_kernel_stack(uint32_t esp0);
+
+#endif
@@ -19,4 +19,23 @@ uint16_t inw(uint16_t port){
     uint16_t value;
     __asm__ __volatile__ ("inw %1, %0" : "=a"(value) : "Nd"(port));
     return value;
-}
\ No newline at end of file
+}
+
+void outl(uint16_t port, uint32_t val) {
+    asm volatile ("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+
+uint32_t inl(uint16_t port){
+    uint32_t value;
+    __asm__ __volatile__ ("inl %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+// String forms move a whole buffer per instruction instead of one call per word
+void insw(uint16_t port, void* buf, uint32_t count){
+    __asm__ __volatile__ ("rep insw" : "+D"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+void outsw(uint16_t port, const void* buf, uint32_t count){
+    __asm__ __volatile__ ("rep outsw" : "+S"(buf), "+c"(count) : "d"(port) : "memory");
+}
@@ -11,4 +11,12 @@ void outw(uint16_t port, uint16_t val);
 
 uint16_t inw(uint16_t port);
 
+void outl(uint16_t port, uint32_t val);
+
+uint32_t inl(uint16_t port);
+
+void insw(uint16_t port, void* buf, uint32_t count);
+
+void outsw(uint16_t port, const void* buf, uint32_t count);
+
 #endif
\ No newline at end of file
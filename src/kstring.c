@@ -0,0 +1,55 @@
+#include "kstring.h"
+#include <stddef.h>
+#include <stdint.h>
+
+void* memcpy(void* dst, const void* src, size_t n) {
+    void* ret = dst;
+    __asm__ __volatile__ (
+        "rep movsb"
+        : "+D"(dst), "+S"(src), "+c"(n)
+        :
+        : "memory");
+    return ret;
+}
+
+void* memmove(void* dst, const void* src, size_t n) {
+    uint8_t* d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
+
+    if (d <= s || d >= s + n) {
+        return memcpy(dst, src, n);
+    }
+
+    // overlapping with dst above src: copy backwards
+    d += n - 1;
+    s += n - 1;
+    __asm__ __volatile__ (
+        "std\n\t"
+        "rep movsb\n\t"
+        "cld"
+        : "+D"(d), "+S"(s), "+c"(n)
+        :
+        : "memory");
+    return dst;
+}
+
+void* memset(void* dst, int c, size_t n) {
+    void* ret = dst;
+    __asm__ __volatile__ (
+        "rep stosb"
+        : "+D"(dst), "+c"(n)
+        : "a"(c)
+        : "memory");
+    return ret;
+}
+
+int memcmp(const void* a, const void* b, size_t n) {
+    const uint8_t* x = (const uint8_t*)a;
+    const uint8_t* y = (const uint8_t*)b;
+    for (size_t i = 0; i < n; ++i) {
+        if (x[i] != y[i]) {
+            return (int)x[i] - (int)y[i];
+        }
+    }
+    return 0;
+}
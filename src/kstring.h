@@ -0,0 +1,15 @@
+#ifndef KSTRING_H
+#define KSTRING_H
+
+#include <stddef.h>
+
+// Freestanding replacements; gcc may also emit calls to these for struct copies.
+void* memcpy(void* dst, const void* src, size_t n);
+
+void* memmove(void* dst, const void* src, size_t n);
+
+void* memset(void* dst, int c, size_t n);
+
+int memcmp(const void* a, const void* b, size_t n);
+
+#endif
@@ -0,0 +1,164 @@
+#include "lz.h"
+#include "kstring.h"
+#include <stdint.h>
+
+#define MIN_MATCH       4
+#define LAST_LITERALS   5       // the block always ends in at least this many literals
+#define MF_LIMIT        12      // no match may start in the last 12 bytes
+#define MAX_OFFSET      65535
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Emit one sequence: `lit` literals from `literals`, then a match of `match`
+// bytes at distance `offset` (match == 0 for the final literal-only sequence).
+// Returns the new output position, or 0 if it would pass `end`.
+static uint8_t* lz_emit(uint8_t* op, uint8_t* end, const uint8_t* literals, uint32_t lit,
+                        uint32_t offset, uint32_t match) {
+    // token + literal length bytes + literals + offset + match length bytes
+    if ((uint32_t)(end - op) < 1 + lit / 255 + 1 + lit + 2 + match / 255 + 1) return 0;
+
+    uint8_t* token = op++;
+    if (lit >= 15) {
+        *token = 15 << 4;
+        uint32_t l = lit - 15;
+        for (; l >= 255; l -= 255) *op++ = 255;
+        *op++ = (uint8_t)l;
+    } else {
+        *token = (uint8_t)(lit << 4);
+    }
+    memcpy(op, literals, lit);
+    op += lit;
+
+    if (match == 0) return op;
+
+    *op++ = (uint8_t)(offset & 0xFF);
+    *op++ = (uint8_t)(offset >> 8);
+
+    uint32_t ml = match - MIN_MATCH;
+    if (ml >= 15) {
+        *token |= 15;
+        ml -= 15;
+        for (; ml >= 255; ml -= 255) *op++ = 255;
+        *op++ = (uint8_t)ml;
+    } else {
+        *token |= (uint8_t)ml;
+    }
+    return op;
+}
+
+uint32_t lz_compress(const uint8_t* src, uint32_t n, uint8_t* dst, uint32_t cap,
+                     struct lz_state* st) {
+    uint8_t* op = dst;
+    uint8_t* end = dst + cap;
+    uint32_t anchor = 0;
+    uint32_t ip = 1;
+
+    if (n > LZ_MAX_INPUT) return 0;
+
+    memset(st->table, 0, sizeof(st->table));
+
+    if (n > MF_LIMIT) {
+        uint32_t limit = n - MF_LIMIT;
+        uint32_t match_end = n - LAST_LITERALS;
+        uint32_t misses = 0;
+
+        while (ip < limit) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = lz_hash(seq);
+            uint32_t ref = st->table[h];
+            st->table[h] = (uint16_t)ip;
+
+            if (ref >= ip || ip - ref > MAX_OFFSET || read32(src + ref) != seq) {
+                // skip faster through data that is not matching
+                ip += 1 + (misses++ >> 5);
+                continue;
+            }
+            misses = 0;
+
+            // extend backwards over literals that also match
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+            }
+
+            uint32_t len = MIN_MATCH;
+            while (ip + len < match_end && src[ref + len] == src[ip + len]) {
+                len++;
+            }
+
+            op = lz_emit(op, end, src + anchor, ip - anchor, ip - ref, len);
+            if (!op) return 0;
+
+            ip += len;
+            anchor = ip;
+            if (ip < limit) {
+                st->table[lz_hash(read32(src + ip - 2))] = (uint16_t)(ip - 2);
+            }
+        }
+    }
+
+    op = lz_emit(op, end, src + anchor, n - anchor, 0, 0);
+    if (!op) return 0;
+    return (uint32_t)(op - dst);
+}
+
+int lz_decompress(const uint8_t* src, uint32_t n, uint8_t* dst, uint32_t cap) {
+    uint32_t ip = 0;
+    uint32_t op = 0;
+
+    while (ip < n) {
+        uint8_t token = src[ip++];
+
+        uint32_t lit = token >> 4;
+        if (lit == 15) {
+            uint8_t b;
+            do {
+                if (ip >= n) return -1;
+                b = src[ip++];
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > n - ip || lit > cap - op) return -1;
+        memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+
+        if (ip == n) break;         // the last sequence has no match
+
+        if (n - ip < 2) return -1;
+        uint32_t offset = src[ip] | ((uint32_t)src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) return -1;
+
+        uint32_t ml = token & 15;
+        if (ml == 15) {
+            uint8_t b;
+            do {
+                if (ip >= n) return -1;
+                b = src[ip++];
+                ml += b;
+            } while (b == 255);
+        }
+        ml += MIN_MATCH;
+        if (ml > cap - op) return -1;
+
+        if (offset >= ml) {
+            memcpy(dst + op, dst + op - offset, ml);
+        } else {
+            // overlapping copy repeats the last `offset` bytes
+            for (uint32_t i = 0; i < ml; ++i) {
+                dst[op + i] = dst[op + i - offset];
+            }
+        }
+        op += ml;
+    }
+    return (int)op;
+}
@@ -0,0 +1,28 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+
+// LZ4 block format codec for inputs of up to 64 KiB (positions fit in 16 bits).
+// Greedy single-probe matching: fast rather than maximal compression.
+
+#define LZ_HASH_BITS   12
+#define LZ_MAX_INPUT   65536
+
+// Match finder state; kept out of the functions so callers decide where the
+// 8 KiB lives (a static in fs.c, or a per-CPU area).
+struct lz_state {
+    uint16_t table[1 << LZ_HASH_BITS];
+};
+
+// Compress `n` bytes into `dst`. Returns the compressed size, or 0 if the
+// output would not fit in `cap` bytes - callers pass the most they are
+// willing to store and fall back to raw data on 0.
+uint32_t lz_compress(const uint8_t* src, uint32_t n, uint8_t* dst, uint32_t cap,
+                     struct lz_state* st);
+
+// Returns the decompressed size, or -1 if the input is malformed or would
+// overflow `cap`.
+int lz_decompress(const uint8_t* src, uint32_t n, uint8_t* dst, uint32_t cap);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef MATH64_H
+#define MATH64_H
+
+#include <stdint.h>
+
+// 64-bit by 32-bit unsigned division without libgcc (__udivdi3 is not linked).
+// Does two 32-bit divl steps so the quotient of each step always fits.
+static inline uint64_t div_u64_u32(uint64_t n, uint32_t d, uint32_t* rem) {
+    uint32_t hi = (uint32_t)(n >> 32);
+    uint32_t lo = (uint32_t)n;
+    uint32_t q_hi = hi / d;
+    uint32_t r = hi % d;
+    uint32_t q_lo;
+
+    __asm__ ("divl %4" : "=a"(q_lo), "=d"(r) : "a"(lo), "d"(r), "rm"(d));
+
+    if (rem) *rem = r;
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include <stdint.h>
+
+// Multiboot (version 1) structures handed over by GRUB in eax/ebx
+
+#define MULTIBOOT_HEADER_MAGIC      0x1BADB002
+#define MULTIBOOT_BOOTLOADER_MAGIC  0x2BADB002
+
+// multiboot_info.flags
+#define MB_INFO_MEMORY    0x001     // mem_lower/mem_upper are valid
+#define MB_INFO_CMDLINE   0x004
+#define MB_INFO_MODS      0x008
+
+struct multiboot_info {
+    uint32_t flags;
+    uint32_t mem_lower;             // KiB below 1 MiB
+    uint32_t mem_upper;             // KiB above 1 MiB
+    uint32_t boot_device;
+    uint32_t cmdline;               // physical address of a NUL-terminated string
+    uint32_t mods_count;
+    uint32_t mods_addr;             // physical address of mods_count multiboot_module
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+} __attribute__((packed));
+
+struct multiboot_module {
+    uint32_t mod_start;
+    uint32_t mod_end;               // first byte past the module
+    uint32_t string;                // the module's command line from grub.cfg
+    uint32_t reserved;
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,69 @@
+#include "paging.h"
+#include "kstring.h"
+#include <stdint.h>
+
+#define PG_PRESENT   0x001
+#define PG_WRITE     0x002
+#define PG_USER      0x004
+#define PG_PWT       0x008
+#define PG_PCD       0x010
+#define PG_LARGE     0x080          // 4 MiB page (PSE)
+
+#define CR0_WP       0x00010000
+#define CR0_PG       0x80000000
+#define CR4_PSE      0x00000010
+
+#define PAGE_SIZE    4096
+#define USER_PAGES   (USER_SIZE / PAGE_SIZE)
+#define MMIO_START   0xC0000000u    // device memory (LAPIC, PCI BARs) lives up here
+
+static uint32_t page_dir[1024] __attribute__((aligned(PAGE_SIZE)));
+static uint32_t user_table[1024] __attribute__((aligned(PAGE_SIZE)));
+static uint8_t  user_mem[USER_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+_Static_assert(USER_SIZE <= 1024 * PAGE_SIZE, "the user window uses one page table");
+_Static_assert((USER_BASE & 0x3FFFFF) == 0, "the user window must start a page table");
+
+void paging_init(void) {
+    for (uint32_t i = 0; i < 1024; ++i) {
+        uint32_t base = i << 22;
+        page_dir[i] = base | PG_LARGE | PG_WRITE | PG_PRESENT;
+        if (base >= MMIO_START) {
+            page_dir[i] |= PG_PCD | PG_PWT;
+        }
+    }
+
+    // Pages past the end of user_mem stay unmapped, so a stray user access
+    // faults instead of reaching kernel memory.
+    for (uint32_t i = 0; i < USER_PAGES; ++i) {
+        user_table[i] = (uint32_t)&user_mem[i * PAGE_SIZE] | PG_USER | PG_WRITE | PG_PRESENT;
+    }
+    page_dir[USER_BASE >> 22] = (uint32_t)user_table | PG_USER | PG_WRITE | PG_PRESENT;
+
+    uint32_t cr0, cr4;
+    __asm__ __volatile__ ("mov %%cr4, %0" : "=r"(cr4));
+    __asm__ __volatile__ ("mov %0, %%cr4" : : "r"(cr4 | CR4_PSE));
+    __asm__ __volatile__ ("mov %0, %%cr3" : : "r"(page_dir) : "memory");
+    __asm__ __volatile__ ("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ __volatile__ ("mov %0, %%cr0" : : "r"(cr0 | CR0_PG | CR0_WP) : "memory");
+}
+
+void paging_clear_user(void) {
+    memset(user_mem, 0, sizeof(user_mem));
+}
+
+uint32_t paging_phys(const void* p) {
+    uint32_t addr = (uint32_t)p;
+    if (addr < USER_BASE || addr >= USER_BASE + 1024 * PAGE_SIZE) return addr;
+    uint32_t pte = user_table[(addr - USER_BASE) / PAGE_SIZE];
+    return (pte & ~(PAGE_SIZE - 1)) | (addr & (PAGE_SIZE - 1));
+}
+
+void paging_map_mmio(uint32_t base, uint32_t len) {
+    if (len == 0) return;
+    for (uint32_t i = base >> 22; i <= (base + len - 1) >> 22; ++i) {
+        if (i == (USER_BASE >> 22)) continue;
+        page_dir[i] |= PG_PCD | PG_PWT;
+        __asm__ __volatile__ ("invlpg (%0)" : : "r"(i << 22) : "memory");
+    }
+}
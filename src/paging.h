@@ -0,0 +1,31 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+
+// The whole 4 GiB is identity mapped with 4 MiB pages that only ring 0 can
+// touch, except for one window of 4 KiB user pages. User programs are linked
+// to run there.
+#define USER_BASE        0x40000000u
+#define USER_SIZE        (1024 * 1024)
+#define USER_END         (USER_BASE + USER_SIZE)
+
+void paging_init(void);
+
+// Zero the user window before a new program is loaded into it
+void paging_clear_user(void);
+
+// Physical address behind a kernel pointer, for DMA. Everything is identity
+// mapped except the user window, whose pages are looked up.
+uint32_t paging_phys(const void* p);
+
+// Make [base, base+len) uncached, for device registers the firmware placed
+// below the range that is uncached from the start
+void paging_map_mmio(uint32_t base, uint32_t len);
+
+// 1 if [addr, addr+len) lies inside the user window
+static inline int user_range_ok(uint32_t addr, uint32_t len) {
+    return addr >= USER_BASE && addr <= USER_END && len <= USER_END - addr;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#include "pci.h"
+#include "io.h"
+#include <stdint.h>
+
+#define PCI_ENABLE          0x80000000u
+#define PCI_MULTIFUNCTION   0x80
+#define PCI_BAR_IO          0x1
+
+static uint32_t config_addr(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    return PCI_ENABLE | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+           ((uint32_t)func << 8) | (offset & 0xFC);
+}
+
+static uint32_t config_read(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    outl(PCI_CONFIG_ADDR, config_addr(bus, slot, func, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint32_t pci_read32(const struct pci_dev* d, uint8_t offset) {
+    return config_read(d->bus, d->slot, d->func, offset);
+}
+
+void pci_write32(const struct pci_dev* d, uint8_t offset, uint32_t value) {
+    outl(PCI_CONFIG_ADDR, config_addr(d->bus, d->slot, d->func, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+int pci_find_class(uint8_t class_code, uint8_t subclass, uint8_t prog_if,
+                   struct pci_dev* out, int max) {
+    int found = 0;
+
+    for (uint32_t bus = 0; bus < 256; ++bus) {
+        for (uint8_t slot = 0; slot < 32; ++slot) {
+            // only multi-function devices have functions past 0
+            uint8_t funcs = 1;
+            for (uint8_t func = 0; func < funcs; ++func) {
+                uint32_t id = config_read((uint8_t)bus, slot, func, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) == 0xFFFF) continue;
+
+                if (func == 0 &&
+                    ((config_read((uint8_t)bus, slot, 0, PCI_HEADER_TYPE) >> 16) & PCI_MULTIFUNCTION)) {
+                    funcs = 8;
+                }
+
+                uint32_t cls = config_read((uint8_t)bus, slot, func, PCI_CLASS_REV);
+                if ((cls >> 24) != class_code || ((cls >> 16) & 0xFF) != subclass ||
+                    ((cls >> 8) & 0xFF) != prog_if) {
+                    continue;
+                }
+                if (found < max) {
+                    struct pci_dev* d = &out[found];
+                    d->bus = (uint8_t)bus;
+                    d->slot = slot;
+                    d->func = func;
+                    d->class_code = class_code;
+                    d->subclass = subclass;
+                    d->prog_if = prog_if;
+                    d->vendor = (uint16_t)(id & 0xFFFF);
+                    d->device = (uint16_t)(id >> 16);
+                }
+                found++;
+            }
+        }
+    }
+    return (found < max) ? found : max;
+}
+
+uint32_t pci_bar_mem(const struct pci_dev* d, int bar) {
+    uint32_t v = pci_read32(d, (uint8_t)(PCI_BAR0 + 4 * bar));
+    return (v & PCI_BAR_IO) ? 0 : (v & ~0xFu);
+}
+
+void pci_enable(const struct pci_dev* d) {
+    // the upper half is the status register, whose bits clear when written as 1
+    uint32_t cmd = pci_read32(d, PCI_COMMAND) & 0xFFFF;
+    pci_write32(d, PCI_COMMAND, cmd | PCI_CMD_MEMORY | PCI_CMD_MASTER);
+}
@@ -0,0 +1,46 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+#define PCI_CONFIG_ADDR     0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+// Configuration space offsets
+#define PCI_VENDOR_ID       0x00
+#define PCI_COMMAND         0x04
+#define PCI_CLASS_REV       0x08
+#define PCI_HEADER_TYPE     0x0C    // byte 2 of the dword
+#define PCI_BAR0            0x10
+
+#define PCI_CMD_MEMORY      0x0002
+#define PCI_CMD_MASTER      0x0004  // the device may start DMA
+
+struct pci_dev {
+    uint8_t  bus;
+    uint8_t  slot;
+    uint8_t  func;
+    uint8_t  class_code;
+    uint8_t  subclass;
+    uint8_t  prog_if;
+    uint16_t vendor;
+    uint16_t device;
+};
+
+uint32_t pci_read32(const struct pci_dev* d, uint8_t offset);
+
+void pci_write32(const struct pci_dev* d, uint8_t offset, uint32_t value);
+
+// Walk every bus through configuration mechanism #1 and fill `out` with the
+// functions of the given class, subclass and programming interface. Returns
+// how many were found, at most `max`.
+int pci_find_class(uint8_t class_code, uint8_t subclass, uint8_t prog_if,
+                   struct pci_dev* out, int max);
+
+// Base address of a memory BAR (the flag bits masked off), 0 for an I/O BAR
+uint32_t pci_bar_mem(const struct pci_dev* d, int bar);
+
+// Turn on memory decoding and bus mastering
+void pci_enable(const struct pci_dev* d);
+
+#endif
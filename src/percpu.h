@@ -0,0 +1,30 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stdint.h>
+
+#define MAX_CPUS  8
+
+// One entry per CPU. gdt_init gives CPU i a data segment based at
+// percpu[i] and that CPU keeps it in %gs, so finding its own entry is a
+// single %gs-relative load. `id` must stay the first field.
+struct percpu {
+    uint32_t id;                    // index into percpu[], 0 is the boot CPU
+    uint32_t apic_id;
+    uint32_t online;                // set by the CPU itself once it is running
+    uint32_t stack_top;
+} __attribute__((aligned(64)));
+
+extern struct percpu percpu[MAX_CPUS];
+
+static inline uint32_t cpu_id(void) {
+    uint32_t id;
+    __asm__ ("movl %%gs:0, %0" : "=r"(id));
+    return id;
+}
+
+static inline struct percpu* this_cpu(void) {
+    return &percpu[cpu_id()];
+}
+
+#endif
@@ -0,0 +1,155 @@
+#include "pool.h"
+#include "percpu.h"
+#include "smp.h"
+#include "trace.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define DEQUE_MASK  (POOL_DEQUE_SIZE - 1)
+
+// Chase-Lev work-stealing deque. The owner pushes and pops at `bottom`
+// without atomics; thieves take the oldest task from `top` with a
+// compare-and-swap. Owner and thieves only contend for the last task.
+struct deque {
+    uint32_t top;
+    uint8_t  _pad[60];              // thieves write `top`; keep the owner's line apart
+    uint32_t bottom;
+    struct task* slots[POOL_DEQUE_SIZE];
+} __attribute__((aligned(64)));
+
+_Static_assert((POOL_DEQUE_SIZE & DEQUE_MASK) == 0, "POOL_DEQUE_SIZE must be a power of two");
+
+static struct deque deques[MAX_CPUS];
+static uint32_t pending;            // submitted tasks not finished yet
+static uint32_t sleepers;           // eligible workers halted until a wake IPI
+static uint32_t active_cpus = MAX_CPUS;
+
+static int dq_push(struct deque* q, struct task* t) {
+    uint32_t b = q->bottom;
+    if (b - __atomic_load_n(&q->top, __ATOMIC_ACQUIRE) >= POOL_DEQUE_SIZE) return -1;
+
+    q->slots[b & DEQUE_MASK] = t;
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static struct task* dq_pop(struct deque* q) {
+    uint32_t b = q->bottom - 1;
+
+    // claim the bottom slot before looking at top, or a thief could take it too
+    __atomic_store_n(&q->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t t = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+
+    if ((int32_t)(b - t) < 0) {
+        __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    struct task* task = q->slots[b & DEQUE_MASK];
+    if (b != t) return task;
+
+    // the last task: whoever moves top first gets it
+    if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        task = NULL;
+    }
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    return task;
+}
+
+static struct task* dq_steal(struct deque* q) {
+    for (;;) {
+        uint32_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        uint32_t b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+        if ((int32_t)(b - t) <= 0) return NULL;
+
+        struct task* task = q->slots[t & DEQUE_MASK];
+        if (__atomic_compare_exchange_n(&q->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return task;
+        }
+        // lost the race to another thief or the owner; look again
+    }
+}
+
+static void run_task(struct task* t) {
+    t->fn(t->arg);
+    ctr_inc(CTR_POOL_TASKS);
+    __atomic_fetch_sub(&pending, 1, __ATOMIC_RELEASE);
+}
+
+// Own deque first, then the others, starting with the next CPU over
+static struct task* find_task(uint32_t self) {
+    struct task* t = dq_pop(&deques[self]);
+    if (t) return t;
+
+    uint32_t n = smp_cpu_count();
+    for (uint32_t i = 1; i < n; ++i) {
+        t = dq_steal(&deques[(self + i) % n]);
+        if (t) {
+            ctr_inc(CTR_POOL_STEALS);
+            return t;
+        }
+    }
+    return NULL;
+}
+
+void pool_submit(struct task* t) {
+    __atomic_fetch_add(&pending, 1, __ATOMIC_RELAXED);
+    if (dq_push(&deques[cpu_id()], t) < 0) {
+        run_task(t);
+        return;
+    }
+
+    // Pairs with pool_worker: it counts itself as a sleeper before looking
+    // for work one last time, so either it sees this task or we see it.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sleepers, __ATOMIC_RELAXED)) smp_wake_others();
+}
+
+void pool_wait(void) {
+    uint32_t self = cpu_id();
+    while (__atomic_load_n(&pending, __ATOMIC_ACQUIRE)) {
+        struct task* t = find_task(self);
+        if (t) {
+            run_task(t);
+        } else {
+            __asm__ __volatile__ ("pause");
+        }
+    }
+}
+
+void pool_set_cpus(uint32_t n) {
+    if (n < 1) n = 1;
+    if (n > smp_cpu_count()) n = smp_cpu_count();
+    __atomic_store_n(&active_cpus, n, __ATOMIC_SEQ_CST);
+    smp_wake_others();
+}
+
+uint32_t pool_cpus(void) {
+    uint32_t n = __atomic_load_n(&active_cpus, __ATOMIC_RELAXED);
+    return n < smp_cpu_count() ? n : smp_cpu_count();
+}
+
+// Interrupts are only enabled inside "sti; hlt": an IPI that arrives
+// between the last look for work and the hlt is held until sti, and the
+// instruction after sti cannot be interrupted, so it still ends the hlt.
+void pool_worker(void) {
+    uint32_t self = cpu_id();
+
+    for (;;) {
+        if (self >= __atomic_load_n(&active_cpus, __ATOMIC_ACQUIRE)) {
+            __asm__ __volatile__ ("sti; hlt; cli" : : : "memory");
+            continue;
+        }
+
+        struct task* t = find_task(self);
+        if (!t) {
+            __atomic_fetch_add(&sleepers, 1, __ATOMIC_SEQ_CST);
+            t = find_task(self);
+            if (!t) __asm__ __volatile__ ("sti; hlt; cli" : : : "memory");
+            __atomic_fetch_sub(&sleepers, 1, __ATOMIC_SEQ_CST);
+        }
+        if (t) run_task(t);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+
+#define POOL_DEQUE_SIZE  1024       // tasks per CPU, power of two
+
+// A unit of work. The submitter owns the struct and keeps it alive until
+// pool_wait returns; tasks may submit more tasks.
+struct task {
+    void (*fn)(void* arg);
+    void* arg;
+};
+
+// Push `t` onto the calling CPU's deque, waking idle CPUs to steal it. A
+// full deque runs the task on the spot.
+void pool_submit(struct task* t);
+
+// Run this CPU's tasks and steal others' until every submitted task is done
+void pool_wait(void);
+
+// Only CPUs below `n` (at least the boot CPU, at most those online) take
+// tasks, to measure how work scales with the CPU count
+void pool_set_cpus(uint32_t n);
+
+uint32_t pool_cpus(void);
+
+// Main loop of every AP: run tasks, steal when out, halt when nobody has
+// any. Never returns.
+void pool_worker(void) __attribute__((noreturn));
+
+#endif
@@ -0,0 +1,150 @@
+#include "ramdisk.h"
+#include "blkdev.h"
+#include "ata.h"
+#include "kstring.h"
+#include "trace.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define RAMDISK_MAX_SECTORS  (1u << 20)     // 512 MiB
+#define RAMDISK_REGION       (1u << RAMDISK_DIRTY_SHIFT)
+#define RAMDISK_REGIONS      (RAMDISK_MAX_SECTORS >> RAMDISK_DIRTY_SHIFT)
+
+struct ramdisk {
+    struct blkdev dev;
+    uint8_t* base;
+    uint32_t sectors;
+    struct blkdev* backing;
+    uint32_t dirty_regions;
+    uint32_t dirty[RAMDISK_REGIONS / 32];
+    char info[40];
+};
+
+static struct ramdisk ram0;
+
+static int ram_check(struct ramdisk* rd, uint32_t lba, uint32_t count) {
+    return (lba + count < lba || lba + count > rd->sectors) ? -1 : 0;
+}
+
+static int ram_read(struct blkdev* dev, uint32_t lba, uint32_t count, void* buf) {
+    struct ramdisk* rd = (struct ramdisk*)dev->priv;
+    if (ram_check(rd, lba, count) < 0) return -1;
+
+    memcpy(buf, rd->base + lba * SECTOR_SIZE, count * SECTOR_SIZE);
+    ctr_add(CTR_RAM_SECT_READ, count);
+    return 0;
+}
+
+static int ram_write(struct blkdev* dev, uint32_t lba, uint32_t count, const void* buf) {
+    struct ramdisk* rd = (struct ramdisk*)dev->priv;
+    if (ram_check(rd, lba, count) < 0) return -1;
+
+    memcpy(rd->base + lba * SECTOR_SIZE, buf, count * SECTOR_SIZE);
+    ctr_add(CTR_RAM_SECT_WRITE, count);
+
+    if (count == 0) return 0;
+    uint32_t last = (lba + count - 1) >> RAMDISK_DIRTY_SHIFT;
+    for (uint32_t r = lba >> RAMDISK_DIRTY_SHIFT; r <= last; ++r) {
+        uint32_t bit = 1u << (r % 32);
+        if (!(rd->dirty[r / 32] & bit)) {
+            rd->dirty[r / 32] |= bit;
+            rd->dirty_regions++;
+        }
+    }
+    return 0;
+}
+
+static int ram_is_dirty(struct ramdisk* rd, uint32_t r) {
+    return (rd->dirty[r / 32] >> (r % 32)) & 1;
+}
+
+// Write each run of dirty regions back with a single request
+static int ram_flush(struct blkdev* dev) {
+    struct ramdisk* rd = (struct ramdisk*)dev->priv;
+    uint32_t regions = (rd->sectors + RAMDISK_REGION - 1) >> RAMDISK_DIRTY_SHIFT;
+
+    if (!rd->backing) return 0;
+
+    uint32_t r = 0;
+    while (r < regions && rd->dirty_regions) {
+        if (!rd->dirty[r / 32]) {
+            r = (r | 31) + 1;           // skip 32 clean regions at once
+            continue;
+        }
+        if (!ram_is_dirty(rd, r)) {
+            r++;
+            continue;
+        }
+
+        uint32_t end = r;
+        while (end < regions && ram_is_dirty(rd, end)) end++;
+
+        uint32_t lba = r << RAMDISK_DIRTY_SHIFT;
+        uint32_t count = (end << RAMDISK_DIRTY_SHIFT) - lba;
+        if (lba + count > rd->sectors) count = rd->sectors - lba;
+
+        if (blk_write(rd->backing, lba, count, rd->base + lba * SECTOR_SIZE) < 0) return -1;
+        ctr_add(CTR_RAM_WRITEBACK, count);
+
+        for (; r < end; ++r) {
+            rd->dirty[r / 32] &= ~(1u << (r % 32));
+            rd->dirty_regions--;
+        }
+    }
+    return blk_flush(rd->backing);
+}
+
+static uint32_t ram_capacity(struct blkdev* dev) {
+    return ((struct ramdisk*)dev->priv)->sectors;
+}
+
+static const struct blkdev_ops ram_ops = {
+    .read     = ram_read,
+    .write    = ram_write,
+    .flush    = ram_flush,
+    .capacity = ram_capacity,
+};
+
+static void ram_describe(struct ramdisk* rd) {
+    char* p = rd->info;
+    const char* s = rd->backing ? "ram, write-back to " : "ram, not backed";
+    while (*s) *p++ = *s++;
+    if (rd->backing) {
+        s = rd->backing->name;
+        while (*s && p < rd->info + sizeof(rd->info) - 1) *p++ = *s++;
+    }
+    *p = '\0';
+}
+
+struct blkdev* ramdisk_create(void* base, uint32_t bytes) {
+    struct ramdisk* rd = &ram0;
+
+    if (rd->dev.ops) return NULL;      // one module-backed disk
+    rd->sectors = bytes / SECTOR_SIZE;
+    if (rd->sectors > RAMDISK_MAX_SECTORS) rd->sectors = RAMDISK_MAX_SECTORS;
+    if (rd->sectors == 0) return NULL;
+
+    rd->base = (uint8_t*)base;
+    rd->dev.ops = &ram_ops;
+    rd->dev.name = "ram0";
+    rd->dev.info = rd->info;
+    rd->dev.priv = rd;
+    ram_describe(rd);
+    if (blkdev_register(&rd->dev) < 0) return NULL;
+    return &rd->dev;
+}
+
+int ramdisk_set_backing(struct blkdev* ram, struct blkdev* backing) {
+    if (!ram || ram->ops != &ram_ops) return -1;
+    struct ramdisk* rd = (struct ramdisk*)ram->priv;
+
+    if (backing && (backing == ram || blk_capacity(backing) < rd->sectors)) return -1;
+    rd->backing = backing;
+    ram_describe(rd);
+    return 0;
+}
+
+uint32_t ramdisk_dirty_sectors(struct blkdev* dev) {
+    if (!dev || dev->ops != &ram_ops) return 0;
+    return ((struct ramdisk*)dev->priv)->dirty_regions << RAMDISK_DIRTY_SHIFT;
+}
@@ -0,0 +1,20 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include <stdint.h>
+#include "blkdev.h"
+
+#define RAMDISK_DIRTY_SHIFT  3      // dirty tracking per 8 sectors (4 KiB)
+
+// Expose `bytes` of memory at `base` (a GRUB module) as block device "ram0".
+// The memory is used in place; a trailing partial sector is ignored.
+struct blkdev* ramdisk_create(void* base, uint32_t bytes);
+
+// Have flushes write changed sectors back to `backing`, which must be at
+// least as large. Passing NULL keeps changes in memory only.
+int ramdisk_set_backing(struct blkdev* ram, struct blkdev* backing);
+
+// Sectors changed since the last write-back, 0 for other devices
+uint32_t ramdisk_dirty_sectors(struct blkdev* dev);
+
+#endif
@@ -0,0 +1,33 @@
+#include "io.h"
+#include "serial.h"
+#include <stdint.h>
+
+void serial_init(void) {
+    outb(COM1_PORT + 1, 0x00);   // no interrupts, we poll
+    outb(COM1_PORT + 3, 0x80);   // DLAB on
+    outb(COM1_PORT + 0, 0x01);   // divisor 1 -> 115200 baud
+    outb(COM1_PORT + 1, 0x00);
+    outb(COM1_PORT + 3, 0x03);   // 8 bits, no parity, one stop bit
+    outb(COM1_PORT + 2, 0xC7);   // FIFO on, cleared, 14-byte threshold
+    outb(COM1_PORT + 4, 0x03);   // DTR + RTS
+}
+
+void serial_putc(char c) {
+    while (!(inb(COM1_PORT + 5) & 0x20)) {
+        // wait for the transmit holding register to drain
+    }
+    outb(COM1_PORT, (uint8_t)c);
+}
+
+void serial_write(const void* data, uint32_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (uint32_t i = 0; i < len; ++i) {
+        serial_putc((char)p[i]);
+    }
+}
+
+void serial_puts(const char* s) {
+    while (*s) {
+        serial_putc(*s++);
+    }
+}
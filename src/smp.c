@@ -0,0 +1,185 @@
+#include "smp.h"
+#include "percpu.h"
+#include "acpi.h"
+#include "gdt.h"
+#include "pool.h"
+#include "timer.h"
+#include "kstring.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Local APIC registers, as byte offsets from its base
+#define LAPIC_ID              0x020
+#define LAPIC_EOI             0x0B0
+#define LAPIC_SVR             0x0F0
+#define LAPIC_ICR_LO          0x300
+#define LAPIC_ICR_HI          0x310
+
+#define SVR_ENABLE            0x100
+#define ICR_INIT              0x00000500
+#define ICR_STARTUP           0x00000600
+#define ICR_PENDING           0x00001000
+#define ICR_ASSERT            0x00004000
+
+#define CPUID_APIC            (1u << 9)
+
+#define INIT_DELAY_US         10000
+#define SIPI_DELAY_US         200
+#define AP_START_TIMEOUT_US   100000
+
+struct percpu percpu[MAX_CPUS];
+
+// Read by the start-up code in boot.s, at ap_boot_data in the copy at
+// AP_TRAMPOLINE. The descriptor table pointers come first, in the form
+// lgdt and lidt take.
+struct ap_boot {
+    uint16_t gdt_limit;
+    uint32_t gdt_base;
+    uint16_t _pad0;
+    uint16_t idt_limit;
+    uint32_t idt_base;
+    uint16_t _pad1;
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t cr0;
+    uint32_t esp;
+    uint32_t gs;
+    uint32_t entry;
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct ap_boot) == 40, "struct ap_boot must match boot.s");
+
+// boot.s
+extern const uint8_t ap_trampoline[];
+extern const uint8_t ap_boot_data[];
+extern const uint8_t ap_trampoline_end[];
+
+static volatile uint32_t* lapic;
+static uint32_t cpus_online = 1;
+static const char* table_source = "none";
+
+static uint8_t ap_stacks[MAX_CPUS][AP_STACK_SIZE] __attribute__((aligned(16)));
+static uint8_t low_page_save[4096];
+
+static uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t v) {
+    lapic[reg / 4] = v;
+}
+
+static void lapic_enable(void) {
+    lapic_write(LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+static void lapic_ipi(uint32_t apic_id, uint32_t cmd) {
+    lapic_write(LAPIC_ICR_HI, apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, cmd);
+    while (lapic_read(LAPIC_ICR_LO) & ICR_PENDING) {
+        __asm__ __volatile__ ("pause");
+    }
+}
+
+void smp_ipi_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+// Addressed to each started CPU by APIC ID: the all-but-self shorthand
+// would also hit APs that never came online
+void smp_wake_others(void) {
+    uint32_t self = cpu_id();
+    for (uint32_t i = 0; i < cpus_online; ++i) {
+        if (i == self || !__atomic_load_n(&percpu[i].online, __ATOMIC_ACQUIRE)) continue;
+        lapic_ipi(percpu[i].apic_id, ICR_ASSERT | IPI_WAKE_VECTOR);
+    }
+}
+
+uint32_t smp_cpu_count(void) {
+    return cpus_online;
+}
+
+const char* smp_table_source(void) {
+    return table_source;
+}
+
+// First C code on an AP: boot.s has loaded the boot CPU's GDT, IDT, page
+// tables and control registers, this CPU's %gs and its stack
+static void ap_main(void) {
+    lapic_enable();
+    __atomic_store_n(&this_cpu()->online, 1, __ATOMIC_RELEASE);
+    pool_worker();
+}
+
+static int ap_wait_online(struct percpu* c, uint32_t us) {
+    uint64_t end = rdtsc() + (div_u64_u32(tsc_hz, 1000000, 0) + 1) * us;
+    while (rdtsc() < end) {
+        if (__atomic_load_n(&c->online, __ATOMIC_ACQUIRE)) return 1;
+        __asm__ __volatile__ ("pause");
+    }
+    return 0;
+}
+
+// APs are started one at a time, so they can share the start-up page
+static int ap_start(uint32_t id, uint8_t apic_id, struct ap_boot* boot) {
+    struct percpu* c = &percpu[id];
+
+    c->apic_id = apic_id;
+    c->stack_top = (uint32_t)(ap_stacks[id] + AP_STACK_SIZE);
+    boot->esp = c->stack_top;
+    boot->gs = GDT_PERCPU + 8 * id;
+
+    // INIT, then up to two start-up IPIs as the MP spec asks; the SIPI
+    // vector is the page number the AP starts executing at
+    lapic_ipi(apic_id, ICR_INIT | ICR_ASSERT);
+    timer_delay_us(INIT_DELAY_US);
+    for (int i = 0; i < 2; ++i) {
+        lapic_ipi(apic_id, ICR_STARTUP | ICR_ASSERT | (AP_TRAMPOLINE >> 12));
+        if (ap_wait_online(c, SIPI_DELAY_US)) return 0;
+    }
+    return ap_wait_online(c, AP_START_TIMEOUT_US) ? 0 : -1;
+}
+
+int smp_init(void) {
+    struct cpu_table t;
+    uint32_t eax = 1, ebx, ecx, edx;
+
+    percpu[0].online = 1;
+    __asm__ __volatile__ ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    if (!(edx & CPUID_APIC) || acpi_find_cpus(&t) < 2) return 1;
+
+    table_source = t.source;
+    lapic = (volatile uint32_t*)t.lapic_base;
+    lapic_enable();
+    percpu[0].apic_id = lapic_read(LAPIC_ID) >> 24;
+
+    uint32_t len = (uint32_t)(ap_trampoline_end - ap_trampoline);
+    struct ap_boot* boot = (struct ap_boot*)(AP_TRAMPOLINE + (uint32_t)(ap_boot_data - ap_trampoline));
+
+    memcpy(low_page_save, (void*)AP_TRAMPOLINE, sizeof(low_page_save));
+    memcpy((void*)AP_TRAMPOLINE, ap_trampoline, len);
+
+    // APs run on exactly the boot CPU's tables and paging setup
+    __asm__ __volatile__ ("sgdt (%0)" : : "r"(&boot->gdt_limit) : "memory");
+    __asm__ __volatile__ ("sidt (%0)" : : "r"(&boot->idt_limit) : "memory");
+    __asm__ __volatile__ ("mov %%cr3, %0" : "=r"(boot->cr3));
+    __asm__ __volatile__ ("mov %%cr4, %0" : "=r"(boot->cr4));
+    __asm__ __volatile__ ("mov %%cr0, %0" : "=r"(boot->cr0));
+    boot->entry = (uint32_t)ap_main;
+
+    int stray = 0;
+    for (int i = 0; i < t.count && cpus_online < MAX_CPUS; ++i) {
+        if (t.apic_id[i] == percpu[0].apic_id) continue;
+        // an AP that missed the deadline may still wake up and read the
+        // start-up page, so stop rather than hand the page to the next one
+        if (ap_start(cpus_online, t.apic_id[i], boot) < 0) {
+            stray = 1;
+            break;
+        }
+        cpus_online++;
+    }
+
+    // ...and for the same reason the page stays the trampoline for good
+    if (!stray) memcpy((void*)AP_TRAMPOLINE, low_page_save, sizeof(low_page_save));
+    return (int)cpus_online;
+}
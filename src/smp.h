@@ -0,0 +1,30 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+
+#define AP_TRAMPOLINE          0x8000   // real-mode start-up page, below 1 MiB
+#define AP_STACK_SIZE          16384
+#define IPI_WAKE_VECTOR        0xF0     // wakes CPUs halted in pool_worker
+#define LAPIC_SPURIOUS_VECTOR  0xFF
+
+// Find the other processors in the firmware tables and start each one with
+// INIT-SIPI-SIPI; they run pool_worker. The start-up code borrows the page
+// at AP_TRAMPOLINE and puts it back afterwards, unless an AP missed its
+// start-up deadline and may still run it. Returns the CPUs online,
+// including this one.
+int smp_init(void);
+
+// CPUs online, including the boot CPU
+uint32_t smp_cpu_count(void);
+
+// Where the CPU list came from: "acpi", "mp" or "none"
+const char* smp_table_source(void);
+
+// Send IPI_WAKE_VECTOR to every other online CPU
+void smp_wake_others(void);
+
+// boot.s: acknowledge a wake IPI
+void smp_ipi_eoi(void);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+
+// Test-and-test-and-set lock. Waiters spin on a plain read so the line
+// stays shared until the holder releases it. Nothing in the kernel takes a
+// lock from an interrupt handler, so interrupts are left as they are.
+struct spinlock {
+    uint32_t locked;
+};
+
+#define SPINLOCK_INIT  { 0 }
+
+static inline void spin_lock(struct spinlock* l) {
+    while (__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&l->locked, __ATOMIC_RELAXED)) {
+            __asm__ __volatile__ ("pause");
+        }
+    }
+}
+
+static inline void spin_unlock(struct spinlock* l) {
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,137 @@
+#include "stripe.h"
+#include "blkdev.h"
+#include "ata.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define STRIPE_ARRAYS  2
+
+struct stripe {
+    struct blkdev dev;
+    struct blkdev* members[STRIPE_MAX_MEMBERS];
+    int n;
+    uint32_t member_sectors;
+    char name[4];
+    char info[40];
+};
+
+static struct stripe arrays[STRIPE_ARRAYS];
+static int array_count;
+
+// Split [lba, lba+count) into chunk-sized pieces and start each on its member.
+// Members with split-phase I/O get their piece submitted and the loop moves on
+// to the next disk while the previous one is still seeking; a member's second
+// piece completes its first. Everything outstanding is finished at the end.
+static int stripe_io(struct blkdev* dev, int write, uint32_t lba, uint32_t count, uint8_t* buf) {
+    struct stripe* s = (struct stripe*)dev->priv;
+    int err = 0;
+
+    if (lba + count > s->member_sectors * (uint32_t)s->n || lba + count < lba) return -1;
+
+    while (count > 0) {
+        uint32_t chunk = lba / STRIPE_CHUNK;
+        uint32_t off = lba % STRIPE_CHUNK;
+        uint32_t n = STRIPE_CHUNK - off;
+        if (n > count) n = count;
+
+        struct blkdev* m = s->members[chunk % (uint32_t)s->n];
+        uint32_t mlba = (chunk / (uint32_t)s->n) * STRIPE_CHUNK + off;
+
+        int r;
+        if (m->ops->submit) {
+            r = m->ops->submit(m, write, mlba, n, buf);
+        } else if (write) {
+            r = blk_write(m, mlba, n, buf);
+        } else {
+            r = blk_read(m, mlba, n, buf);
+        }
+        if (r < 0) {
+            err = -1;
+            break;
+        }
+
+        lba += n;
+        count -= n;
+        buf += n * SECTOR_SIZE;
+    }
+
+    for (int i = 0; i < s->n; ++i) {
+        struct blkdev* m = s->members[i];
+        if (m->ops->complete && m->ops->complete(m) < 0) err = -1;
+    }
+    return err;
+}
+
+static int stripe_read(struct blkdev* dev, uint32_t lba, uint32_t count, void* buf) {
+    return stripe_io(dev, 0, lba, count, (uint8_t*)buf);
+}
+
+static int stripe_write(struct blkdev* dev, uint32_t lba, uint32_t count, const void* buf) {
+    return stripe_io(dev, 1, lba, count, (uint8_t*)buf);
+}
+
+static int stripe_flush(struct blkdev* dev) {
+    struct stripe* s = (struct stripe*)dev->priv;
+    int err = 0;
+    for (int i = 0; i < s->n; ++i) {
+        if (blk_flush(s->members[i]) < 0) err = -1;
+    }
+    return err;
+}
+
+static uint32_t stripe_capacity(struct blkdev* dev) {
+    struct stripe* s = (struct stripe*)dev->priv;
+    return s->member_sectors * (uint32_t)s->n;
+}
+
+static const struct blkdev_ops stripe_ops = {
+    .read     = stripe_read,
+    .write    = stripe_write,
+    .flush    = stripe_flush,
+    .capacity = stripe_capacity,
+};
+
+struct blkdev* stripe_create(struct blkdev** members, int n) {
+    if (n < 2 || n > STRIPE_MAX_MEMBERS || array_count >= STRIPE_ARRAYS) return NULL;
+
+    uint32_t smallest = 0xFFFFFFFF;
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < i; ++j) {
+            if (members[i] == members[j]) return NULL;
+        }
+        uint32_t cap = blk_capacity(members[i]);
+        if (cap < smallest) smallest = cap;
+    }
+    smallest -= smallest % STRIPE_CHUNK;
+    if (smallest == 0) return NULL;
+
+    struct stripe* s = &arrays[array_count];
+    s->n = n;
+    s->member_sectors = smallest;
+    for (int i = 0; i < n; ++i) s->members[i] = members[i];
+
+    s->name[0] = 'm';
+    s->name[1] = 'd';
+    s->name[2] = (char)('0' + array_count);
+    s->name[3] = '\0';
+
+    // info reads "raid0 ata1+ata3"
+    const char* prefix = "raid0 ";
+    uint32_t p = 0;
+    while (*prefix) s->info[p++] = *prefix++;
+    for (int i = 0; i < n; ++i) {
+        const char* nm = members[i]->name;
+        if (i > 0 && p < sizeof(s->info) - 1) s->info[p++] = '+';
+        while (*nm && p < sizeof(s->info) - 1) s->info[p++] = *nm++;
+    }
+    s->info[p] = '\0';
+
+    s->dev.ops = &stripe_ops;
+    s->dev.name = s->name;
+    s->dev.info = s->info;
+    s->dev.priv = s;
+    if (blkdev_register(&s->dev) < 0) return NULL;
+
+    array_count++;
+    return &s->dev;
+}
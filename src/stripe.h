@@ -0,0 +1,16 @@
+#ifndef STRIPE_H
+#define STRIPE_H
+
+#include <stdint.h>
+#include "blkdev.h"
+
+#define STRIPE_MAX_MEMBERS  4
+#define STRIPE_CHUNK        16      // sectors per chunk (8 KiB)
+
+// RAID-0 over `n` devices: chunk i lives on member i % n. Each member
+// contributes its capacity rounded down to whole chunks, up to the smallest
+// member's. Registers the array as "md0", "md1", ... and returns it, or NULL
+// if the members are unsuitable (fewer than two, repeated, or too small).
+struct blkdev* stripe_create(struct blkdev** members, int n);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+// System call ABI, shared with the user programs in user/.
+//
+// eax holds the call number and ebx, esi, edi the arguments; the result
+// comes back in eax, negative on error (the FS_E* codes). ecx and edx are
+// clobbered. Enter with `int 0x80`, or with SYSENTER when SYS_INFO reports
+// SYSINFO_SYSENTER: ecx = the stack pointer to return with and edx = the
+// address to return to.
+
+#define SYSCALL_VECTOR   0x80
+
+#define SYS_EXIT         0      // (code)
+#define SYS_WRITE        1      // (fd, buf, len): fd 1 is the console
+#define SYS_READ         2      // (fd, buf, len): fd 0 is the keyboard, one key per call
+#define SYS_OPEN         3      // (path) -> fd, read-only
+#define SYS_CLOSE        4      // (fd)
+#define SYS_WRITEFILE    5      // (path, buf, len): create or replace a whole file
+#define SYS_UNLINK       6      // (path)
+#define SYS_INFO         7      // -> SYSINFO_* bits
+#define SYS_NULL         8      // returns 0; measures the entry/exit path alone
+#define SYS_COUNT        9
+
+#define SYSINFO_SYSENTER 0x1
+
+#define SYS_EBADF        -20
+#define SYS_EFAULT       -21
+#define SYS_ENOSYS       -22
+#define SYS_EMFILE       -23
+
+#endif
@@ -0,0 +1,47 @@
+#include "io.h"
+#include "timer.h"
+#include "math64.h"
+#include <stdint.h>
+
+uint64_t tsc_hz;           // 64 bits: a 4.3 GHz TSC no longer fits in 32
+
+#define CALIBRATE_MS  10
+
+void timer_init(void) {
+    uint16_t count = (uint16_t)(PIT_FREQ_HZ / (1000 / CALIBRATE_MS));
+
+    // gate channel 2 off and the speaker off while it is programmed
+    uint8_t gate = inb(PIT_GATE_PORT) & ~0x03;
+    outb(PIT_GATE_PORT, gate);
+
+    outb(PIT_CMD_PORT, 0xB0);   // channel 2, lobyte/hibyte, mode 0, binary
+    outb(PIT_CH2_PORT, (uint8_t)(count & 0xFF));
+    outb(PIT_CH2_PORT, (uint8_t)(count >> 8));
+
+    uint64_t start = rdtsc();
+    outb(PIT_GATE_PORT, gate | 0x01);   // raise gate, countdown starts
+
+    while (!(inb(PIT_GATE_PORT) & 0x20)) {
+        // OUT2 goes high when the count reaches zero
+    }
+    uint64_t end = rdtsc();
+
+    outb(PIT_GATE_PORT, gate);
+    tsc_hz = (end - start) * (1000 / CALIBRATE_MS);
+    if (tsc_hz == 0) tsc_hz = 1;
+}
+
+uint64_t timer_cycles_to_us(uint64_t cycles) {
+    uint32_t per_us = (uint32_t)div_u64_u32(tsc_hz, 1000000, 0);
+    if (per_us == 0) per_us = 1;
+    return div_u64_u32(cycles, per_us, 0);
+}
+
+void timer_delay_us(uint32_t us) {
+    uint64_t per_us = div_u64_u32(tsc_hz, 1000000, 0);
+    if (per_us == 0) per_us = 1;
+    uint64_t end = rdtsc() + per_us * us;
+    while (rdtsc() < end) {
+        __asm__ __volatile__ ("pause");
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include "math64.h"
+
+#define PIT_FREQ_HZ      1193182
+#define PIT_CH2_PORT     0x42
+#define PIT_CMD_PORT     0x43
+#define PIT_GATE_PORT    0x61
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// TSC ticks per second, measured against PIT channel 2 by timer_init().
+extern uint64_t tsc_hz;
+
+void timer_init(void);
+
+uint64_t timer_cycles_to_us(uint64_t cycles);
+
+void timer_delay_us(uint32_t us);
+
+#endif
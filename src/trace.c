@@ -0,0 +1,99 @@
+#include "trace.h"
+#include "serial.h"
+#include <stdint.h>
+
+struct trace_cpu_counters trace_counters[TRACE_MAX_CPUS];
+
+const char* const trace_counter_names[CTR_COUNT] = {
+    [CTR_ATA_SECT_READ]   = "ata.sectors_read",
+    [CTR_ATA_SECT_WRITE]  = "ata.sectors_written",
+    [CTR_ATA_BUSY_WAITS]  = "ata.busy_waits",
+    [CTR_ATA_BUSY_SPINS]  = "ata.busy_spins",
+    [CTR_ATA_BUSY_CYCLES] = "ata.busy_cycles",
+    [CTR_ATA_DRQ_SPINS]   = "ata.drq_spins",
+    [CTR_RAM_SECT_READ]   = "ram.sectors_read",
+    [CTR_RAM_SECT_WRITE]  = "ram.sectors_written",
+    [CTR_RAM_WRITEBACK]   = "ram.sectors_written_back",
+    [CTR_AHCI_SECT_READ]  = "ahci.sectors_read",
+    [CTR_AHCI_SECT_WRITE] = "ahci.sectors_written",
+    [CTR_AHCI_COMMANDS]   = "ahci.commands",
+    [CTR_AHCI_QUEUE_FULL] = "ahci.queue_full_waits",
+    [CTR_FS_LOOKUP]       = "fs.lookups",
+    [CTR_FS_LOOKUP_MISS]  = "fs.lookup_misses",
+    [CTR_FS_NODE_READ]    = "fs.node_reads",
+    [CTR_FS_NODE_CACHE_HIT] = "fs.node_cache_hits",
+    [CTR_FS_READ]         = "fs.reads",
+    [CTR_FS_READ_BYTES]   = "fs.read_bytes",
+    [CTR_FS_WRITE]        = "fs.writes",
+    [CTR_FS_WRITE_BYTES]  = "fs.write_bytes",
+    [CTR_FS_WRITE_STORED] = "fs.write_stored_bytes",
+    [CTR_LZ_DECODE_CYCLES] = "lz.decode_cycles",
+    [CTR_FS_CRC_ERRORS]   = "fs.crc_errors",
+    [CTR_CRC_BYTES]       = "crc.bytes",
+    [CTR_CRC_CYCLES]      = "crc.cycles",
+    [CTR_FS_DELETE]       = "fs.deletes",
+    [CTR_KBD_SCANCODE]    = "kbd.scancodes",
+    [CTR_SYSCALLS]        = "syscalls",
+    [CTR_POOL_TASKS]      = "pool.tasks",
+    [CTR_POOL_STEALS]     = "pool.steals",
+    [CTR_TRACE_RECORDS]   = "trace.records",
+};
+
+static struct trace_record trace_ring[TRACE_RING_SIZE];
+static uint32_t trace_head;     // total records ever written, wraps the ring
+
+void trace_event(enum trace_event ev, uint32_t arg0, uint32_t arg1, uint32_t arg2) {
+    // CPUs claim slots with one locked add; a record being filled while the
+    // ring is dumped may come out half written
+    uint32_t slot = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    struct trace_record* r = &trace_ring[slot & (TRACE_RING_SIZE - 1)];
+
+    r->tsc = rdtsc();
+    r->event = (uint16_t)ev;
+    r->cpu = (uint16_t)trace_cpu_id();
+    r->arg0 = arg0;
+    r->arg1 = arg1;
+    r->arg2 = arg2;
+
+    ctr_inc(CTR_TRACE_RECORDS);
+}
+
+uint64_t trace_counter_total(enum trace_counter c) {
+    uint64_t sum = 0;
+    for (int cpu = 0; cpu < TRACE_MAX_CPUS; ++cpu) {
+        sum += trace_counters[cpu].v[c];
+    }
+    return sum;
+}
+
+uint32_t trace_records_held(void) {
+    return (trace_head < TRACE_RING_SIZE) ? trace_head : TRACE_RING_SIZE;
+}
+
+void trace_reset(void) {
+    for (int cpu = 0; cpu < TRACE_MAX_CPUS; ++cpu) {
+        for (int c = 0; c < CTR_COUNT; ++c) {
+            trace_counters[cpu].v[c] = 0;
+        }
+    }
+    trace_head = 0;
+}
+
+void trace_dump_serial(void) {
+    uint32_t held = trace_records_held();
+    uint32_t head = trace_head;
+
+    struct trace_dump_header h;
+    h.magic = TRACE_DUMP_MAGIC;
+    h.version = TRACE_DUMP_VERSION;
+    h.record_size = sizeof(struct trace_record);
+    h.record_count = held;
+    h.tsc_hz = tsc_hz;
+    h.dropped = trace_counter_total(CTR_TRACE_RECORDS) - held;
+    serial_write(&h, sizeof(h));
+
+    // oldest record first
+    for (uint32_t i = head - held; i != head; ++i) {
+        serial_write(&trace_ring[i & (TRACE_RING_SIZE - 1)], sizeof(struct trace_record));
+    }
+}
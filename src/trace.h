@@ -0,0 +1,114 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "timer.h"
+#include "percpu.h"
+
+#define TRACE_MAX_CPUS      MAX_CPUS
+#define TRACE_RING_SIZE     4096            // records, power of two
+#define TRACE_DUMP_MAGIC    0x43525454      // "TTRC" little-endian
+#define TRACE_DUMP_VERSION  2               // 2: tsc_hz widened to 64 bits
+
+// Counters are bumped on the hot paths; each CPU owns a cache-line padded row
+// so increments never bounce lines between cores.
+enum trace_counter {
+    CTR_ATA_SECT_READ,
+    CTR_ATA_SECT_WRITE,
+    CTR_ATA_BUSY_WAITS,
+    CTR_ATA_BUSY_SPINS,
+    CTR_ATA_BUSY_CYCLES,
+    CTR_ATA_DRQ_SPINS,
+    CTR_RAM_SECT_READ,
+    CTR_RAM_SECT_WRITE,
+    CTR_RAM_WRITEBACK,
+    CTR_AHCI_SECT_READ,
+    CTR_AHCI_SECT_WRITE,
+    CTR_AHCI_COMMANDS,
+    CTR_AHCI_QUEUE_FULL,
+    CTR_FS_LOOKUP,
+    CTR_FS_LOOKUP_MISS,
+    CTR_FS_NODE_READ,
+    CTR_FS_NODE_CACHE_HIT,
+    CTR_FS_READ,
+    CTR_FS_READ_BYTES,
+    CTR_FS_WRITE,
+    CTR_FS_WRITE_BYTES,
+    CTR_FS_WRITE_STORED,
+    CTR_LZ_DECODE_CYCLES,
+    CTR_FS_CRC_ERRORS,
+    CTR_CRC_BYTES,
+    CTR_CRC_CYCLES,
+    CTR_FS_DELETE,
+    CTR_KBD_SCANCODE,
+    CTR_SYSCALLS,
+    CTR_POOL_TASKS,
+    CTR_POOL_STEALS,
+    CTR_TRACE_RECORDS,
+    CTR_COUNT
+};
+
+enum trace_event {
+    EV_NONE,
+    EV_ATA_READ,        // lba, cycles
+    EV_ATA_WRITE,       // lba, cycles
+    EV_FS_LOOKUP,       // record lba or -1 on a miss, B-tree nodes visited
+    EV_FS_READ,         // data lba, bytes, offset
+    EV_FS_WRITE,        // data lba, bytes, bytes stored
+    EV_FS_DELETE,       // data or directory root lba
+    EV_KBD_SCANCODE,    // scancode
+    EV_AHCI_READ,       // lba, cycles from submit to reap
+    EV_AHCI_WRITE,      // lba, cycles from submit to reap
+};
+
+// One 24-byte record in the binary ring. `trace dump` streams these raw over
+// COM1 behind a struct trace_dump_header so they can be decoded offline.
+struct trace_record {
+    uint64_t tsc;
+    uint16_t event;
+    uint16_t cpu;
+    uint32_t arg0;
+    uint32_t arg1;
+    uint32_t arg2;
+} __attribute__((packed));
+
+struct trace_dump_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t record_count;
+    uint64_t tsc_hz;
+    uint64_t dropped;       // records overwritten before this dump
+} __attribute__((packed));
+
+struct trace_cpu_counters {
+    uint64_t v[CTR_COUNT];
+} __attribute__((aligned(64)));
+
+extern struct trace_cpu_counters trace_counters[TRACE_MAX_CPUS];
+
+extern const char* const trace_counter_names[CTR_COUNT];
+
+static inline uint32_t trace_cpu_id(void) {
+    return cpu_id();
+}
+
+static inline void ctr_add(enum trace_counter c, uint64_t n) {
+    trace_counters[trace_cpu_id()].v[c] += n;
+}
+
+static inline void ctr_inc(enum trace_counter c) {
+    ctr_add(c, 1);
+}
+
+void trace_event(enum trace_event ev, uint32_t arg0, uint32_t arg1, uint32_t arg2);
+
+uint64_t trace_counter_total(enum trace_counter c);
+
+uint32_t trace_records_held(void);
+
+void trace_reset(void);
+
+void trace_dump_serial(void);
+
+#endif
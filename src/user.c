@@ -0,0 +1,264 @@
+#include "user.h"
+#include "syscall.h"
+#include "paging.h"
+#include "gdt.h"
+#include "elf.h"
+#include "fs.h"
+#include "kstring.h"
+#include "trace.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define MSR_SYSENTER_CS   0x174
+#define MSR_SYSENTER_ESP  0x175
+#define MSR_SYSENTER_EIP  0x176
+#define USER_FD_BASE      3             // 0-2 are the console
+
+// boot.s
+extern int user_enter(uint32_t entry, uint32_t esp);
+extern void user_return(int code) __attribute__((noreturn));
+extern void sysenter_entry(void);
+
+struct user_fd {
+    int used;
+    uint32_t pos;
+    struct fs_file f;
+};
+
+// Ring 3 entries (int 0x80, SYSENTER, exceptions) start on this stack
+static uint8_t kstack[8192] __attribute__((aligned(16)));
+static uint8_t image[FS_MAX_FILE_SIZE];
+static int has_sysenter;
+
+static const struct user_console* con;
+static struct user_fd fds[USER_FDS];
+
+static inline void wrmsr(uint32_t msr, uint32_t lo, uint32_t hi) {
+    __asm__ __volatile__ ("wrmsr" : : "c"(msr), "a"(lo), "d"(hi));
+}
+
+void user_init(void) {
+    uint32_t top = (uint32_t)(kstack + sizeof(kstack));
+    tss_set_kernel_stack(top);
+
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ __volatile__ ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    uint32_t family = (eax >> 8) & 0xF, model = (eax >> 4) & 0xF, stepping = eax & 0xF;
+
+    // Early Pentium Pros report SEP without implementing it
+    has_sysenter = ((edx >> 11) & 1) && !(family == 6 && model < 3 && stepping < 3);
+    if (has_sysenter) {
+        wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE, 0);
+        wrmsr(MSR_SYSENTER_ESP, top, 0);
+        wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry, 0);
+    }
+}
+
+int user_sysenter_supported(void) {
+    return has_sysenter;
+}
+
+// ===== Loader =====
+
+static int elf_load(uint32_t size, uint32_t* entry) {
+    const struct elf32_ehdr* eh = (const struct elf32_ehdr*)image;
+
+    if (size < sizeof(*eh) || eh->magic != ELF_MAGIC || eh->class != ELFCLASS32 ||
+        eh->data != ELFDATA2LSB || eh->type != ET_EXEC || eh->machine != EM_386 ||
+        eh->phentsize != sizeof(struct elf32_phdr) ||
+        eh->phoff > size || (uint32_t)eh->phnum * sizeof(struct elf32_phdr) > size - eh->phoff) {
+        return USER_ENOEXEC;
+    }
+
+    paging_clear_user();
+
+    const struct elf32_phdr* ph = (const struct elf32_phdr*)(image + eh->phoff);
+    int loaded = 0;
+    for (int i = 0; i < eh->phnum; ++i) {
+        if (ph[i].type != PT_LOAD) continue;
+
+        // every segment must sit below the stack, inside the window
+        if (ph[i].filesz > ph[i].memsz || ph[i].offset > size || ph[i].filesz > size - ph[i].offset ||
+            !user_range_ok(ph[i].vaddr, ph[i].memsz) ||
+            (uint64_t)ph[i].vaddr + ph[i].memsz > USER_END - USER_STACK_SIZE) {
+            return USER_ENOEXEC;
+        }
+        memcpy((void*)ph[i].vaddr, image + ph[i].offset, ph[i].filesz);
+        loaded++;
+    }
+
+    if (!loaded || !user_range_ok(eh->entry, 1)) return USER_ENOEXEC;
+    *entry = eh->entry;
+    return 0;
+}
+
+int user_exec(const char* path, const char* args, const struct user_console* c) {
+    uint32_t entry;
+
+    int n = fs_read_file(path, image, sizeof(image));
+    if (n < 0) return n;
+    int r = elf_load((uint32_t)n, &entry);
+    if (r < 0) return r;
+
+    // Stack: the argument string at the very top, then main's frame
+    char* uargs = (char*)(USER_END - USER_ARGS_MAX);
+    uint32_t len = 0;
+    while (args && args[len] && len < USER_ARGS_MAX - 1) {
+        uargs[len] = args[len];
+        len++;
+    }
+    uargs[len] = '\0';
+
+    // _start(const char* args) is entered as if called: a (never used)
+    // return address on top and esp + 4 16-byte aligned
+    uint32_t* sp = (uint32_t*)(uargs - 20);
+    sp[0] = 0;
+    sp[1] = (uint32_t)uargs;
+
+    con = c;
+    memset(fds, 0, sizeof(fds));
+    return user_enter(entry, (uint32_t)sp);
+}
+
+// ===== Faults =====
+
+static char* put_hex(char* p, uint32_t v) {
+    *p++ = '0';
+    *p++ = 'x';
+    for (int s = 28; s >= 0; s -= 4) {
+        *p++ = "0123456789abcdef"[(v >> s) & 0xF];
+    }
+    return p;
+}
+
+static char* put_str(char* p, const char* s) {
+    while (*s) *p++ = *s++;
+    return p;
+}
+
+void user_fault(uint32_t vector, uint32_t eip, uint32_t error, uint32_t cr2) {
+    char msg[96];
+    char* p = put_str(msg, "\nKilled: exception ");
+    *p++ = (char)('0' + vector / 10);
+    *p++ = (char)('0' + vector % 10);
+    p = put_str(p, " at eip ");
+    p = put_hex(p, eip);
+    if (vector == 14) {
+        p = put_str(p, ", address ");
+        p = put_hex(p, cr2);
+    } else if (error) {
+        p = put_str(p, ", error ");
+        p = put_hex(p, error);
+    }
+    *p++ = '\n';
+    con->write(msg, (uint32_t)(p - msg), con->ctx);
+    user_return(USER_EKILLED);
+}
+
+// ===== System calls =====
+
+// Copy a NUL-terminated path out of the user window
+static int user_path(uint32_t addr, char* out) {
+    for (uint32_t i = 0; i < FS_PATH_MAX; ++i) {
+        if (!user_range_ok(addr + i, 1)) return SYS_EFAULT;
+        out[i] = *(const char*)(addr + i);
+        if (out[i] == '\0') return 0;
+    }
+    return FS_EINVAL;
+}
+
+static struct user_fd* user_fd(uint32_t fd) {
+    if (fd < USER_FD_BASE || fd >= USER_FD_BASE + USER_FDS) return NULL;
+    struct user_fd* f = &fds[fd - USER_FD_BASE];
+    return f->used ? f : NULL;
+}
+
+static int sys_read(uint32_t fd, uint32_t buf, uint32_t len) {
+    if (!user_range_ok(buf, len)) return SYS_EFAULT;
+    if (len == 0) return 0;
+
+    if (fd == 0) {
+        *(char*)buf = (char)con->getc(con->ctx);
+        return 1;
+    }
+    struct user_fd* f = user_fd(fd);
+    if (!f) return SYS_EBADF;
+    int n = fs_pread(&f->f, f->pos, (uint8_t*)buf, len);
+    if (n > 0) f->pos += (uint32_t)n;
+    return n;
+}
+
+static int sys_open(uint32_t path) {
+    char p[FS_PATH_MAX];
+    int r = user_path(path, p);
+    if (r < 0) return r;
+
+    for (int i = 0; i < USER_FDS; ++i) {
+        if (!fds[i].used) {
+            r = fs_open(p, &fds[i].f);
+            if (r < 0) return r;
+            fds[i].used = 1;
+            fds[i].pos = 0;
+            return USER_FD_BASE + i;
+        }
+    }
+    return SYS_EMFILE;
+}
+
+// Called from both entry stubs in boot.s with the user's eax, ebx, esi, edi
+int syscall_dispatch(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3) {
+    char p[FS_PATH_MAX];
+    int r;
+
+    ctr_inc(CTR_SYSCALLS);
+    switch (nr) {
+    case SYS_NULL:
+        return 0;
+
+    case SYS_EXIT:
+        user_return((int)(a1 & 0xFF));
+
+    case SYS_WRITE:
+        if (a1 != 1) return SYS_EBADF;
+        if (!user_range_ok(a2, a3)) return SYS_EFAULT;
+        con->write((const char*)a2, a3, con->ctx);
+        return (int)a3;
+
+    case SYS_READ:
+        return sys_read(a1, a2, a3);
+
+    case SYS_OPEN:
+        return sys_open(a1);
+
+    case SYS_CLOSE: {
+        struct user_fd* f = user_fd(a1);
+        if (!f) return SYS_EBADF;
+        f->used = 0;
+        return 0;
+    }
+
+    case SYS_WRITEFILE:
+        r = user_path(a1, p);
+        if (r < 0) return r;
+        if (!user_range_ok(a2, a3)) return SYS_EFAULT;
+        return fs_write_file(p, (const uint8_t*)a2, a3);
+
+    case SYS_UNLINK:
+        r = user_path(a1, p);
+        return (r < 0) ? r : fs_delete_file(p);
+
+    case SYS_INFO:
+        return has_sysenter ? SYSINFO_SYSENTER : 0;
+
+    default:
+        return SYS_ENOSYS;
+    }
+}
+
+const char* user_strerror(int err) {
+    switch (err) {
+    case USER_ENOEXEC: return "Not an executable";
+    case USER_EKILLED: return "Program was killed";
+    default:           return fs_strerror(err);
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef USER_H
+#define USER_H
+
+#include <stdint.h>
+
+#define USER_STACK_SIZE  (64 * 1024)    // top of the user window
+#define USER_ARGS_MAX    128
+#define USER_FDS         8
+
+// user_exec errors, alongside the FS_E* codes
+#define USER_ENOEXEC     -30
+#define USER_EKILLED     -31
+
+// Where a program's console output goes and its keyboard input comes from
+struct user_console {
+    void (*write)(const char* s, uint32_t len, void* ctx);
+    int  (*getc)(void* ctx);
+    void* ctx;
+};
+
+// Program the SYSENTER MSRs and the ring 0 stack; after gdt_init
+void user_init(void);
+
+// Load the ELF32 executable at `path` into the user window and run it in
+// ring 3 until it exits. `args` is passed to its main. Returns the exit
+// status (0-255) or a negative error.
+int user_exec(const char* path, const char* args, const struct user_console* con);
+
+// From the trap handler: kill the running program over an exception it took
+// in ring 3. Does not return.
+void user_fault(uint32_t vector, uint32_t eip, uint32_t error, uint32_t cr2) __attribute__((noreturn));
+
+int user_sysenter_supported(void);
+
+const char* user_strerror(int err);
+
+#endif
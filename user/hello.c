@@ -0,0 +1,24 @@
+#include "ulib.h"
+
+// Echo the arguments, then show a file if one is named
+int main(const char* args) {
+    char buf[256];
+
+    puts("Hello from ring 3! args: \"");
+    puts(args);
+    puts("\"\n");
+
+    if (args[0] == '\0') return 0;
+
+    int fd = open(args);
+    if (fd < 0) {
+        puts("(not a readable file)\n");
+        return 1;
+    }
+    int n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        write(1, buf, (uint32_t)n);
+    }
+    close(fd);
+    return 0;
+}
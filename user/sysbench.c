@@ -0,0 +1,71 @@
+#include "ulib.h"
+#include "math64.h"
+
+// Time SYS_NULL through int 0x80 and through SYSENTER: the calls do no work,
+// so the difference is the cost of the two entry/exit paths.
+
+#define DEFAULT_ITERS  100000
+
+static uint32_t parse_u32(const char* s) {
+    uint32_t v = 0;
+    while (*s >= '0' && *s <= '9') {
+        v = v * 10 + (uint32_t)(*s++ - '0');
+    }
+    return v;
+}
+
+static uint64_t bench_int80(uint32_t n) {
+    uint64_t t0 = urdtsc();
+    for (uint32_t i = 0; i < n; ++i) {
+        sys_int80(SYS_NULL, 0, 0, 0);
+    }
+    return urdtsc() - t0;
+}
+
+static uint64_t bench_sysenter(uint32_t n) {
+    uint64_t t0 = urdtsc();
+    for (uint32_t i = 0; i < n; ++i) {
+        sys_sysenter(SYS_NULL, 0, 0, 0);
+    }
+    return urdtsc() - t0;
+}
+
+static void report(const char* label, uint64_t cycles, uint32_t n) {
+    puts(label);
+    putu(div_u64_u32(cycles, n, 0));
+    puts(" cycles/call\n");
+}
+
+int main(const char* args) {
+    uint32_t n = parse_u32(args);
+    if (n == 0) n = DEFAULT_ITERS;
+    int fast = sys_int80(SYS_INFO, 0, 0, 0) & SYSINFO_SYSENTER;
+
+    puts("null syscall x ");
+    putu(n);
+    puts("\n");
+
+    bench_int80(n / 10 + 1);                    // warm up
+    uint64_t slow = bench_int80(n);
+    report("  int 0x80: ", slow, n);
+
+    if (!fast) {
+        puts("  sysenter: not supported by this CPU\n");
+        return 0;
+    }
+    bench_sysenter(n / 10 + 1);
+    uint64_t quick = bench_sysenter(n);
+    report("  sysenter: ", quick, n);
+
+    // speedup with two decimals
+    if (quick == 0) quick = 1;
+    uint64_t x100 = div_u64_u32(slow * 100, (uint32_t)(quick > 0xFFFFFFFF ? 0xFFFFFFFF : quick), 0);
+    uint32_t frac;
+    puts("  speedup:  ");
+    putu(div_u64_u32(x100, 100, &frac));
+    puts(".");
+    if (frac < 10) puts("0");
+    putu(frac);
+    puts("x\n");
+    return 0;
+}
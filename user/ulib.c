@@ -0,0 +1,62 @@
+#include "ulib.h"
+#include "math64.h"
+
+int main(const char* args);
+
+static int fast_syscalls;
+
+void _start(const char* args) {
+    fast_syscalls = sys_int80(SYS_INFO, 0, 0, 0) & SYSINFO_SYSENTER;
+    exit(main(args));
+}
+
+int syscall(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3) {
+    return fast_syscalls ? sys_sysenter(nr, a1, a2, a3) : sys_int80(nr, a1, a2, a3);
+}
+
+void exit(int code) {
+    syscall(SYS_EXIT, (uint32_t)code, 0, 0);
+    for (;;) {
+    }
+}
+
+int write(int fd, const void* buf, uint32_t len) {
+    return syscall(SYS_WRITE, (uint32_t)fd, (uint32_t)buf, len);
+}
+
+int read(int fd, void* buf, uint32_t len) {
+    return syscall(SYS_READ, (uint32_t)fd, (uint32_t)buf, len);
+}
+
+int open(const char* path) {
+    return syscall(SYS_OPEN, (uint32_t)path, 0, 0);
+}
+
+int close(int fd) {
+    return syscall(SYS_CLOSE, (uint32_t)fd, 0, 0);
+}
+
+int writefile(const char* path, const void* buf, uint32_t len) {
+    return syscall(SYS_WRITEFILE, (uint32_t)path, (uint32_t)buf, len);
+}
+
+uint32_t strlen(const char* s) {
+    uint32_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+void puts(const char* s) {
+    write(1, s, strlen(s));
+}
+
+void putu(uint64_t v) {
+    char tmp[21];
+    int n = sizeof(tmp);
+    do {
+        uint32_t digit;
+        v = div_u64_u32(v, 10, &digit);
+        tmp[--n] = (char)('0' + digit);
+    } while (v != 0);
+    write(1, tmp + n, sizeof(tmp) - n);
+}
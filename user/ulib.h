@@ -0,0 +1,60 @@
+#ifndef ULIB_H
+#define ULIB_H
+
+#include <stdint.h>
+#include "syscall.h"
+
+// Minimal runtime for TinyOS user programs. Programs define
+// `int main(const char* args)`; returning from it exits.
+
+static inline int sys_int80(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3) {
+    int ret;
+    __asm__ __volatile__ ("int $0x80"
+                          : "=a"(ret)
+                          : "a"(nr), "b"(a1), "S"(a2), "D"(a3)
+                          : "ecx", "edx", "memory");
+    return ret;
+}
+
+// The kernel returns with SYSEXIT to edx on the stack in ecx
+static inline int sys_sysenter(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3) {
+    int ret;
+    __asm__ __volatile__ ("movl %%esp, %%ecx\n\t"
+                          "movl $1f, %%edx\n\t"
+                          "sysenter\n"
+                          "1:"
+                          : "=a"(ret)
+                          : "a"(nr), "b"(a1), "S"(a2), "D"(a3)
+                          : "ecx", "edx", "memory");
+    return ret;
+}
+
+static inline uint64_t urdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Uses SYSENTER when the kernel reports it, int 0x80 otherwise
+int syscall(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3);
+
+void exit(int code) __attribute__((noreturn));
+
+int write(int fd, const void* buf, uint32_t len);
+
+int read(int fd, void* buf, uint32_t len);
+
+int open(const char* path);
+
+int close(int fd);
+
+int writefile(const char* path, const void* buf, uint32_t len);
+
+uint32_t strlen(const char* s);
+
+void puts(const char* s);
+
+// Decimal, no newline
+void putu(uint64_t v);
+
+#endif